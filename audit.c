@@ -0,0 +1,415 @@
+/*
+	exhal / inhal recompression audit
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "codec.h"
+#include "compress.h"
+#include "index.h"
+#include "pool.h"
+#include "rom.h"
+#include "timer.h"
+
+// compression levels to try (same as inhal's -1 to -4)
+#define LEVELS 4
+
+// number of streams decompressed at once for each thread (each one needs a 64 kb buffer)
+#define UNPACK_BATCH 64
+
+// compressed data found in the ROM
+typedef struct {
+	size_t   offset;
+	// size of the original compressed data, and of the uncompressed data
+	size_t   inputsize, outputsize;
+	uint8_t *unpacked;
+	
+	// results of recompressing at each level
+	size_t   packed[LEVELS];
+	double   time[LEVELS];
+	int      failed[LEVELS];
+} audit_stream_t;
+
+// buffers used by each thread
+typedef struct {
+	exhal_context_t *ctx;
+	uint8_t *packed, *unpacked;
+} audit_thread_t;
+
+typedef struct {
+	const rom_t    *rom;
+	audit_stream_t *streams;
+	size_t count, alloc;
+	
+	// streams in the order they're compressed in (largest first)
+	audit_stream_t **order;
+	audit_thread_t  *threads;
+} audit_t;
+
+// ------------------------------------------------------------------------------------------------
+static void audit_add(audit_t *this, size_t offset) {
+	if (this->count == this->alloc) {
+		this->alloc = this->alloc ? 2 * this->alloc : 256;
+		this->streams = realloc(this->streams, this->alloc * sizeof(audit_stream_t));
+		if (!this->streams) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+	}
+	
+	memset(&this->streams[this->count], 0, sizeof(audit_stream_t));
+	this->streams[this->count++].offset = offset;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads the offsets to check, either from an index file saved by sniff (-o or -cache), or a
+// text file with one offset per line. Lines in the format printed by sniff ("070000: ...") can
+// also be used, so sniff's output can be saved and used directly.
+static void audit_read(audit_t *this, const char *path) {
+	sniff_index_t index;
+	char  line[4096];
+	FILE *file;
+	
+	if (index_read(&index, path)) {
+		if (index.romsize != this->rom->size)
+			fprintf(stderr, "Warning: %s is from a scan of a different ROM\n", path);
+		// index files contain every result, including the ones inside of other data
+		// (the same ones skipped by sniff -skip), which are almost never real
+		size_t end = 0;
+		for (size_t i = 0; i < index.count; i++) {
+			const sniff_result_t *result = &index.results[i];
+			
+			if (result->codec != CODEC_HAL || result->offset < end) continue;
+			audit_add(this, result->offset);
+			end = result->offset + result->inputsize;
+		}
+		index_free(&index);
+		return;
+	}
+	
+	if (!(file = fopen(path, "r"))) {
+		fprintf(stderr, "Error: unable to open %s\n", path);
+		exit(-1);
+	}
+	
+	while (fgets(line, sizeof(line), file)) {
+		char *offset, *end;
+		int   skip = 0;
+		
+		// skip results in other compression formats
+		for (int i = 0; i < CODEC_COUNT; i++) {
+			char name[64];
+			snprintf(name, sizeof(name), "(%s)", codecs[i].name);
+			if (i != CODEC_HAL && strstr(line, name)) skip = 1;
+		}
+		// and results inside of other data (from sniff -skip -nested), the same as with an index
+		if (strstr(line, "(nested)")) skip = 1;
+		
+		line[strcspn(line, "#\r\n")] = 0;
+		if (skip || !(offset = strtok(line, " \t"))) continue;
+		
+		// skip anything that isn't an offset (i.e. sniff's header)
+		size_t len = strlen(offset);
+		if (offset[len - 1] == ':') {
+			// sniff output: hex digits followed by a colon
+			if (len == 1 || strspn(offset, "0123456789abcdefABCDEF") != len - 1) continue;
+			audit_add(this, strtoul(offset, NULL, 16));
+		} else {
+			unsigned long value = strtoul(offset, &end, 0);
+			if (end == offset || *end) continue;
+			audit_add(this, value);
+		}
+	}
+	
+	fclose(file);
+}
+
+// ------------------------------------------------------------------------------------------------
+static int stream_offset_compare(const void *a, const void *b) {
+	const audit_stream_t *sa = (const audit_stream_t*)a, *sb = (const audit_stream_t*)b;
+	
+	if (sa->offset != sb->offset) return sa->offset < sb->offset ? -1 : 1;
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static int stream_size_compare(const void *a, const void *b) {
+	const audit_stream_t *sa = *(audit_stream_t* const*)a, *sb = *(audit_stream_t* const*)b;
+	
+	if (sa->outputsize != sb->outputsize) return sa->outputsize > sb->outputsize ? -1 : 1;
+	return sa->offset < sb->offset ? -1 : 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompresses every stream from the ROM, several at a time on each thread.
+// Returns the time taken in seconds.
+static double audit_unpack(audit_t *this, int threads) {
+	size_t batchsize = (size_t)threads * UNPACK_BATCH;
+	unpack_job_t    *jobs    = malloc(batchsize * sizeof(unpack_job_t));
+	audit_stream_t **streams = malloc(batchsize * sizeof(audit_stream_t*));
+	uint8_t         *buffers = malloc(batchsize * DATA_SIZE);
+	
+	if (!jobs || !streams || !buffers) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	double time = timer_now();
+	for (size_t start = 0; start < this->count; start += batchsize) {
+		size_t end = start + batchsize < this->count ? start + batchsize : this->count;
+		size_t count = 0;
+		
+		for (size_t i = start; i < end; i++) {
+			audit_stream_t *stream = &this->streams[i];
+			if (stream->offset >= this->rom->size) continue;
+			
+			memset(&jobs[count], 0, sizeof(unpack_job_t));
+			jobs[count].packed   = rom_packed(this->rom, stream->offset);
+			jobs[count].unpacked = buffers + count * DATA_SIZE;
+			streams[count++]     = stream;
+		}
+		// back references can read data that hasn't been written yet, which should always be zero
+		memset(buffers, 0, count * DATA_SIZE);
+		exhal_unpack_batch(jobs, count, threads);
+		
+		for (size_t i = 0; i < count; i++) {
+			audit_stream_t *stream = streams[i];
+			
+			stream->outputsize = jobs[i].outputsize;
+			stream->inputsize  = jobs[i].stats.inputsize;
+			if (stream->outputsize && (stream->unpacked = malloc(stream->outputsize)))
+				memcpy(stream->unpacked, jobs[i].unpacked, stream->outputsize);
+			else
+				stream->outputsize = 0;
+		}
+	}
+	time = timer_now() - time;
+	
+	free(jobs);
+	free(streams);
+	free(buffers);
+	return time;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Recompresses a range of streams at a single level each, and checks that the result
+// decompresses to the same thing.
+static void audit_pack(void *arg, size_t start, size_t end, int thread) {
+	audit_t *this = (audit_t*)arg;
+	audit_thread_t *buffers = &this->threads[thread];
+	
+	for (size_t i = start; i < end; i++) {
+		audit_stream_t *stream = this->order[i / LEVELS];
+		int level = i % LEVELS;
+		pack_options_t options = {
+			.fast    = level == 0 || level == 2,
+			.optimal = level >= 2,
+		};
+		
+		if (!stream->outputsize) continue;
+		
+		double time = timer_now();
+		stream->packed[level] = exhal_pack3(buffers->ctx, stream->unpacked, stream->outputsize,
+		                                    buffers->packed, &options);
+		stream->time[level] = timer_now() - time;
+		
+		memset(buffers->unpacked, 0, DATA_SIZE);
+		if (!stream->packed[level]
+		    || exhal_unpack(buffers->packed, buffers->unpacked, NULL) != stream->outputsize
+		    || memcmp(buffers->unpacked, stream->unpacked, stream->outputsize))
+			stream->failed[level] = 1;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Prints the results for each stream, then totals and timing for each level.
+// Returns the number of streams which failed the round trip at any level.
+static int audit_print(const audit_t *this, double unpacktime, double time) {
+	size_t totalin = 0, totalout = 0, totals[LEVELS] = {0}, best = 0, valid = 0;
+	double times[LEVELS] = {0}, slowest[LEVELS] = {0};
+	int    failures[LEVELS] = {0}, errors = 0, wins[LEVELS] = {0};
+	
+	printf("Offset    Unpacked Original       -1       -2       -3       -4  Best\n");
+	
+	for (size_t i = 0; i < this->count; i++) {
+		const audit_stream_t *stream = &this->streams[i];
+		int bestlevel = -1;
+		
+		if (!stream->outputsize) {
+			printf("0x%06lX  not valid compressed data\n", (unsigned long)stream->offset);
+			continue;
+		}
+		
+		printf("0x%06lX %8lu %8lu", (unsigned long)stream->offset,
+		       (unsigned long)stream->outputsize, (unsigned long)stream->inputsize);
+		for (int level = 0; level < LEVELS; level++) {
+			if (stream->failed[level]) {
+				printf("     FAIL");
+				failures[level]++;
+				continue;
+			}
+			printf(" %8lu", (unsigned long)stream->packed[level]);
+			if (bestlevel < 0 || stream->packed[level] < stream->packed[bestlevel]) bestlevel = level;
+			
+			totals[level] += stream->packed[level];
+			times[level]  += stream->time[level];
+			if (stream->time[level] > slowest[level]) slowest[level] = stream->time[level];
+		}
+		
+		if (bestlevel >= 0) {
+			printf("  -%d (%+ld)\n", bestlevel + 1, (long)stream->packed[bestlevel] - (long)stream->inputsize);
+			best += stream->packed[bestlevel];
+			wins[bestlevel]++;
+		} else {
+			printf("\n");
+		}
+		
+		totalin  += stream->outputsize;
+		totalout += stream->inputsize;
+		valid++;
+	}
+	
+	printf("\nTotal    %8lu %8lu", (unsigned long)totalin, (unsigned long)totalout);
+	for (int level = 0; level < LEVELS; level++)
+		printf(" %8lu", (unsigned long)totals[level]);
+	printf("  %lu (%+ld)\n\n", (unsigned long)best, (long)best - (long)totalout);
+	
+	printf("Level                         -1       -2       -3       -4\n");
+	printf("Change from original    ");
+	for (int level = 0; level < LEVELS; level++)
+		printf(" %+8ld", (long)totals[level] - (long)totalout);
+	printf("\nSmallest for streams    ");
+	for (int level = 0; level < LEVELS; level++)
+		printf(" %8d", wins[level]);
+	printf("\nRound trip failures     ");
+	for (int level = 0; level < LEVELS; level++) {
+		printf(" %8d", failures[level]);
+		errors += failures[level];
+	}
+	printf("\nCompression time (s)    ");
+	for (int level = 0; level < LEVELS; level++)
+		printf(" %8.3f", times[level]);
+	printf("\nSlowest stream (s)      ");
+	for (int level = 0; level < LEVELS; level++)
+		printf(" %8.3f", slowest[level]);
+	printf("\nThroughput (MB/s)       ");
+	for (int level = 0; level < LEVELS; level++)
+		printf(" %8.2f", times[level] > 0 ? totalin / times[level] / 1000000 : 0.0);
+	
+	printf("\n\n%lu streams, decompressed in %.3f seconds, audited in %.3f seconds\n",
+	       (unsigned long)valid, unpacktime, time);
+	
+	return errors;
+}
+
+int main (int argc, char **argv) {
+	printf("halaudit - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n");
+	
+	int threads = 0, i;
+	
+	for (i = 1; i < argc - 2; i++) {
+		if (!strcmp(argv[i], "-j") && i < argc - 3) {
+			threads = atoi(argv[++i]);
+		} else {
+			break;
+		}
+	}
+	
+	if (argc - i != 2) {
+		fprintf(stderr, "Usage:\n%s [-j threads] romfile listfile\n\n"
+		                "Decompresses the data at each offset in listfile, recompresses it at each level,\n"
+		                "checks that the result decompresses correctly, and compares the sizes.\n"
+		                "listfile can be a list of offsets, the output of sniff, or an index file\n"
+		                "saved by sniff.\n",
+		                argv[0]);
+		exit(-1);
+	}
+	
+	audit_t audit = {0};
+	
+	if (!(audit.rom = rom_open(argv[i], 0))) {
+		fprintf(stderr, "Error: unable to open %s\n", argv[i]);
+		exit(-1);
+	}
+	audit_read(&audit, argv[i + 1]);
+	if (threads <= 0) threads = pool_default_threads();
+	
+	// check each offset only once
+	qsort(audit.streams, audit.count, sizeof(audit_stream_t), stream_offset_compare);
+	size_t count = 0;
+	for (size_t j = 0; j < audit.count; j++) {
+		if (!count || audit.streams[j].offset != audit.streams[count - 1].offset)
+			audit.streams[count++] = audit.streams[j];
+	}
+	audit.count = count;
+	
+	audit.threads = calloc(threads, sizeof(audit_thread_t));
+	audit.order   = malloc((audit.count ? audit.count : 1) * sizeof(audit_stream_t*));
+	if (!audit.threads || !audit.order) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (int j = 0; j < threads; j++) {
+		audit_thread_t *thread = &audit.threads[j];
+		if (!(thread->ctx = exhal_context_alloc())
+		    || !(thread->packed = malloc(DATA_SIZE)) || !(thread->unpacked = malloc(DATA_SIZE))) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+	}
+	
+	double time = timer_now();
+	double unpacktime = audit_unpack(&audit, threads);
+	
+	// compress the slowest (largest) streams first
+	for (size_t j = 0; j < audit.count; j++)
+		audit.order[j] = &audit.streams[j];
+	qsort(audit.order, audit.count, sizeof(audit_stream_t*), stream_size_compare);
+	pool_run(audit.count * LEVELS, 1, threads, audit_pack, &audit);
+	time = timer_now() - time;
+	
+	int errors = audit_print(&audit, unpacktime, time);
+	
+	for (int j = 0; j < threads; j++) {
+		exhal_context_free(audit.threads[j].ctx);
+		free(audit.threads[j].packed);
+		free(audit.threads[j].unpacked);
+	}
+	for (size_t j = 0; j < audit.count; j++)
+		free(audit.streams[j].unpacked);
+	free(audit.streams);
+	free(audit.threads);
+	free(audit.order);
+	rom_close((rom_t*)audit.rom);
+	
+	if (errors) {
+		fprintf(stderr, "Error: %d stream(s) did not decompress correctly after recompression\n", errors);
+		return -1;
+	}
+	return 0;
+}
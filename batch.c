@@ -0,0 +1,44 @@
+/*
+	exhal / inhal batch decompression
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include "batch.h"
+#include "pool.h"
+
+// number of jobs handed to exhal_unpack_multi at once by exhal_unpack_batch
+#define BATCH_GRAIN 64
+
+// ------------------------------------------------------------------------------------------------
+static void unpack_batch_func(void *arg, size_t start, size_t end, int thread) {
+	exhal_unpack_multi((unpack_job_t*)arg + start, end - start);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompresses (or validates) a number of files using multiple threads.
+// threads can be 0 to use one thread per CPU.
+void exhal_unpack_batch(unpack_job_t *jobs, size_t count, int threads) {
+	if (threads <= 0) threads = pool_default_threads();
+	
+	pool_run(count, BATCH_GRAIN, threads, unpack_batch_func, jobs);
+}
@@ -0,0 +1,172 @@
+/*
+	exhal / inhal compression benchmark
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#include "corpus.h"
+#include "timer.h"
+
+// compression levels (same as inhal's -1 to -4)
+#define LEVELS 4
+
+// sizes of the files generated for each kind of data
+static const size_t sample_sizes[] = {1024, 4096, 16384};
+#define NUM_SAMPLES (sizeof(sample_sizes) / sizeof(sample_sizes[0]))
+
+// stop repeating a file once it's taken this many seconds in total
+// (some data can take a very long time to compress optimally)
+#define MAX_SAMPLE_TIME 2.0
+
+// ------------------------------------------------------------------------------------------------
+static int double_compare(const void *a, const void *b) {
+	double da = *(const double*)a, db = *(const double*)b;
+	
+	return da < db ? -1 : da > db;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns a percentile (0-100) of a sorted list of times, using the nearest-rank method.
+static double percentile(const double *times, size_t count, int percent) {
+	size_t rank = (count * percent + 99) / 100;
+	
+	return times[rank ? rank - 1 : 0];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compresses every file for one kind of data at one level, and prints the results as JSON.
+// Returns 0 if any data didn't decompress correctly.
+static int bench_run(const corpus_class_t *type, int level, int iterations, int first) {
+	uint8_t  unpacked[DATA_SIZE], packed[DATA_SIZE], check[DATA_SIZE];
+	double  *times = malloc(NUM_SAMPLES * iterations * sizeof(double)), total = 0;
+	size_t   inputsize = 0, outputsize = 0, bytes = 0, count = 0;
+	int      ok = 1;
+	pack_options_t options = {
+		.fast    = level == 1 || level == 3,
+		.optimal = level >= 3,
+	};
+	
+	if (!times) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	fprintf(stderr, "%s -%d\n", type->name, level);
+	
+	for (size_t i = 0; i < NUM_SAMPLES; i++) {
+		size_t size = sample_sizes[i], packedsize = 0;
+		
+		type->generate(unpacked, size, i + 1);
+		
+		double sampletime = 0;
+		for (int j = 0; j < iterations && sampletime < MAX_SAMPLE_TIME; j++) {
+			double time = timer_now();
+			packedsize = exhal_pack2(unpacked, size, packed, &options);
+			times[count] = timer_now() - time;
+			sampletime += times[count++];
+			bytes += size;
+		}
+		total += sampletime;
+		
+		memset(check, 0, DATA_SIZE);
+		if (!packedsize || exhal_unpack(packed, check, NULL) != size || memcmp(check, unpacked, size)) {
+			fprintf(stderr, "Error: %s sample %d did not decompress correctly at level %d\n",
+			        type->name, (int)i, level);
+			ok = 0;
+		}
+		inputsize  += size;
+		outputsize += packedsize;
+	}
+	
+	qsort(times, count, sizeof(double), double_compare);
+	printf("%s    {\"class\": \"%s\", \"level\": %d, \"inputsize\": %lu, \"outputsize\": %lu, "
+	       "\"ratio\": %.3f, \"runs\": %lu, \"mbps\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f}",
+	       first ? "" : ",\n", type->name, level, (unsigned long)inputsize, (unsigned long)outputsize,
+	       outputsize ? (double)inputsize / outputsize : 0.0, (unsigned long)count,
+	       total > 0 ? bytes / total / 1000000 : 0.0,
+	       1000 * percentile(times, count, 50), 1000 * percentile(times, count, 99));
+	
+	free(times);
+	return ok;
+}
+
+int main (int argc, char **argv) {
+	const corpus_class_t *only = NULL;
+	int iterations = 5, onlylevel = 0, ok = 1, first = 1;
+	
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i < argc - 1) {
+			iterations = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-class") && i < argc - 1) {
+			if (!(only = corpus_find(corpus_classes, corpus_num_classes, argv[++i]))) {
+				fprintf(stderr, "Error: unknown class %s\n", argv[i]);
+				exit(-1);
+			}
+		} else if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '4' && !argv[i][2]) {
+			onlylevel = argv[i][1] - '0';
+		} else {
+			iterations = 0;
+			break;
+		}
+	}
+	
+	if (iterations <= 0) {
+		fprintf(stderr, "halbench - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n"
+		                "Usage:\n%s [-n iterations] [-class name] [-1|-2|-3|-4]\n\n"
+		                "Compresses generated data at each level and prints the results as JSON.\n"
+		                "Each file is compressed up to n times (default 5), or until it has taken\n"
+		                "%.0f seconds.\n"
+		                "Classes:",
+		                argv[0], MAX_SAMPLE_TIME);
+		for (size_t i = 0; i < corpus_num_classes; i++)
+			fprintf(stderr, " %s", corpus_classes[i].name);
+		fprintf(stderr, "\n");
+		exit(-1);
+	}
+	
+	printf("{\n");
+	printf("  \"build\": \"" __DATE__ " " __TIME__ "\",\n");
+	printf("  \"version\": %d,\n", EXHAL_PACK_VERSION);
+	printf("  \"iterations\": %d,\n", iterations);
+	printf("  \"sizes\": [");
+	for (size_t i = 0; i < NUM_SAMPLES; i++)
+		printf("%s%lu", i ? ", " : "", (unsigned long)sample_sizes[i]);
+	printf("],\n");
+	printf("  \"results\": [\n");
+	
+	for (size_t i = 0; i < corpus_num_classes; i++) {
+		if (only && only != &corpus_classes[i]) continue;
+		for (int level = 1; level <= LEVELS; level++) {
+			if (onlylevel && level != onlylevel) continue;
+			ok = bench_run(&corpus_classes[i], level, iterations, first) && ok;
+			first = 0;
+		}
+	}
+	
+	printf("\n  ]\n}\n");
+	return ok ? 0 : -1;
+}
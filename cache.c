@@ -0,0 +1,251 @@
+/*
+	exhal / inhal compression cache
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "hash.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static const char cache_magic[8] = "HALCACHE";
+
+#define HEADER_SIZE (8 + 4 + 4)
+
+// a file in the cache directory, used when deciding what to remove
+typedef struct {
+	char    *path;
+	uint64_t size;
+	time_t   mtime;
+} cache_file_t;
+
+// ------------------------------------------------------------------------------------------------
+static uint8_t* put32(uint8_t *out, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		*out++ = value >> (8 * i);
+	return out;
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint32_t get32(const uint8_t *in) {
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the path of the file for a cache key (which must be freed by the caller).
+static char* cache_path(const char *dir, uint64_t key) {
+	char *path = malloc(strlen(dir) + 32);
+	
+	if (path) sprintf(path, "%s/%016" PRIx64 ".hal", dir, key);
+	return path;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the cache key for some data compressed with a given set of options.
+uint64_t cache_key(const uint8_t *unpacked, size_t inputsize, const pack_options_t *options) {
+	uint8_t params[5 * 4], *out = params;
+	
+	out = put32(out, EXHAL_PACK_VERSION);
+	out = put32(out, options->fast);
+	out = put32(out, options->optimal);
+	out = put32(out, options->speedweight);
+	out = put32(out, options->platform);
+	
+	return hash64(unpacked, inputsize, hash64(params, sizeof(params), 0));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Looks for previously compressed data in a cache directory.
+// The data is only used if it actually decompresses to the same thing as the input, so hash
+// collisions (or files damaged some other way) just count as a miss.
+// Returns the size of the compressed data, or 0 if it wasn't found.
+size_t cache_get(const char *dir, uint64_t key, const uint8_t *unpacked, size_t inputsize, uint8_t *packed) {
+	char    *path = cache_path(dir, key);
+	uint8_t  header[HEADER_SIZE];
+	uint8_t *check = malloc(DATA_SIZE);
+	size_t   outputsize = 0;
+	FILE    *file;
+	
+	if (!path || !check || !(file = fopen(path, "rb"))) goto done;
+	
+	if (fread(header, 1, HEADER_SIZE, file) == HEADER_SIZE
+	    && !memcmp(header, cache_magic, sizeof(cache_magic))
+	    && get32(header + 8) == EXHAL_PACK_VERSION) {
+		outputsize = get32(header + 12);
+		if (!outputsize || outputsize > DATA_SIZE || fread(packed, 1, outputsize, file) != outputsize)
+			outputsize = 0;
+	}
+	fclose(file);
+	
+	if (outputsize) {
+		unpack_stats_t stats;
+		
+		memset(check, 0, DATA_SIZE);
+		if (exhal_unpack(packed, check, &stats) != inputsize || stats.inputsize != outputsize
+		    || memcmp(check, unpacked, inputsize)) {
+			outputsize = 0;
+		} else {
+			// mark the file as recently used
+			utime(path, NULL);
+		}
+	}
+
+done:
+	free(path);
+	free(check);
+	return outputsize;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Saves compressed data to a cache directory. The data is written to a temporary file first and
+// then renamed, so other processes using the same cache never see a partially written file.
+// Returns 0 on failure.
+int cache_put(const char *dir, uint64_t key, const uint8_t *packed, size_t outputsize) {
+	char    *path = cache_path(dir, key);
+	char    *temp = malloc(strlen(dir) + 64);
+	uint8_t  header[HEADER_SIZE];
+	int      ok = 0;
+	
+	if (!path || !temp) goto done;
+	
+	memcpy(header, cache_magic, sizeof(cache_magic));
+	put32(put32(header + sizeof(cache_magic), EXHAL_PACK_VERSION), outputsize);
+	
+	// the buffer address tells apart threads of the same process storing the same data
+	sprintf(temp, "%s/%016" PRIx64 ".%ld.%lx.tmp", dir, key, (long)getpid(), (unsigned long)(uintptr_t)packed);
+	FILE *file = fopen(temp, "wb");
+	if (!file) goto done;
+	
+	ok = fwrite(header, 1, HEADER_SIZE, file) == HEADER_SIZE
+	  && fwrite(packed, 1, outputsize, file) == outputsize;
+	ok = !fclose(file) && ok;
+
+#ifdef _WIN32
+	ok = ok && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && !rename(temp, path);
+#endif
+	if (!ok) remove(temp);
+
+done:
+	free(path);
+	free(temp);
+	return ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+static int file_time_compare(const void *a, const void *b) {
+	const cache_file_t *fa = (const cache_file_t*)a, *fb = (const cache_file_t*)b;
+	
+	if (fa->mtime != fb->mtime) return fa->mtime < fb->mtime ? -1 : 1;
+	return strcmp(fa->path, fb->path);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Removes the least recently used files from a cache directory until it's no larger than maxsize.
+void cache_trim(const char *dir, uint64_t maxsize) {
+	DIR *handle = opendir(dir);
+	struct dirent *entry;
+	cache_file_t *files = NULL;
+	size_t count = 0, alloc = 0;
+	uint64_t total = 0;
+	
+	if (!handle) return;
+	
+	while ((entry = readdir(handle))) {
+		size_t len = strlen(entry->d_name);
+		struct stat st;
+		char *path;
+		
+		if (len < 4 || strcmp(entry->d_name + len - 4, ".hal")) continue;
+		if (!(path = malloc(strlen(dir) + len + 2))) break;
+		sprintf(path, "%s/%s", dir, entry->d_name);
+		
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		
+		if (count == alloc) {
+			cache_file_t *newfiles = realloc(files, (alloc = alloc ? 2 * alloc : 256) * sizeof(cache_file_t));
+			if (!newfiles) {
+				free(path);
+				break;
+			}
+			files = newfiles;
+		}
+		files[count].path  = path;
+		files[count].size  = st.st_size;
+		files[count].mtime = st.st_mtime;
+		total += st.st_size;
+		count++;
+	}
+	closedir(handle);
+	
+	if (total > maxsize) {
+		qsort(files, count, sizeof(cache_file_t), file_time_compare);
+		// another process may have removed a file already, which is fine
+		for (size_t i = 0; i < count && total > maxsize; i++) {
+			remove(files[i].path);
+			total -= files[i].size;
+		}
+	}
+	
+	for (size_t i = 0; i < count; i++)
+		free(files[i].path);
+	free(files);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Same as exhal_pack2, but reuses data from a cache directory if it was compressed before (and
+// saves it there otherwise). If hit isn't NULL, it's set to 1 if the data came from the cache.
+size_t cache_pack(const char *dir, uint8_t *unpacked, size_t inputsize, uint8_t *packed,
+                  const pack_options_t *options, int *hit) {
+	uint64_t key = cache_key(unpacked, inputsize, options);
+	size_t   outputsize;
+	
+	if (hit) *hit = 0;
+	if ((outputsize = cache_get(dir, key, unpacked, inputsize, packed))) {
+		if (hit) *hit = 1;
+		return outputsize;
+	}
+	
+	if ((outputsize = exhal_pack2(unpacked, inputsize, packed, options)))
+		cache_put(dir, key, packed, outputsize);
+	return outputsize;
+}
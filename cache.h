@@ -0,0 +1,52 @@
+/*
+	exhal / inhal compression cache
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "compress.h"
+
+// default max. size of a cache directory (in bytes)
+#define CACHE_DEFAULT_SIZE (256ull << 20)
+
+uint64_t cache_key(const uint8_t *unpacked, size_t inputsize, const pack_options_t *options);
+size_t   cache_get(const char *dir, uint64_t key, const uint8_t *unpacked, size_t inputsize, uint8_t *packed);
+int      cache_put(const char *dir, uint64_t key, const uint8_t *packed, size_t outputsize);
+void     cache_trim(const char *dir, uint64_t maxsize);
+size_t   cache_pack(const char *dir, uint8_t *unpacked, size_t inputsize, uint8_t *packed,
+                    const pack_options_t *options, int *hit);
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
@@ -0,0 +1,325 @@
+/*
+	exhal / inhal compression server test client
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "compress.h"
+#include "server.h"
+#include "timer.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+// a file to send to the server
+typedef struct {
+	const char *path;
+	uint8_t    *data;
+	size_t      size;
+} client_file_t;
+
+typedef struct {
+	FILE *in, *out;
+	
+	server_request_t request;
+	client_file_t   *files;
+	size_t count, repeat;
+	// time each request was sent at (for measuring latency)
+	double *sent;
+} client_t;
+
+// ------------------------------------------------------------------------------------------------
+static int double_compare(const void *a, const void *b) {
+	double da = *(const double*)a, db = *(const double*)b;
+	
+	return da < db ? -1 : da > db;
+}
+
+#ifndef _WIN32
+
+// ------------------------------------------------------------------------------------------------
+// Sends every request to the server without waiting for any responses.
+static void* client_send(void *arg) {
+	client_t *this = (client_t*)arg;
+	uint8_t header[REQUEST_SIZE];
+	
+	for (size_t i = 0; i < this->count * this->repeat; i++) {
+		client_file_t *file = &this->files[i % this->count];
+		server_request_t request = this->request;
+		
+		request.id   = i;
+		request.size = file->size;
+		server_put_request(header, &request);
+		
+		this->sent[i] = timer_now();
+		if (fwrite(header, 1, REQUEST_SIZE, this->out) != REQUEST_SIZE
+		    || fwrite(file->data, 1, file->size, this->out) != file->size
+		    || fflush(this->out)) {
+			fprintf(stderr, "Error: unable to send request\n");
+			exit(-1);
+		}
+	}
+	
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Connects to a server listening on a Unix domain socket.
+static void client_connect(client_t *this, const char *path) {
+	struct sockaddr_un addr = {0};
+	int fd, fd2;
+	
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	    || connect(fd, (struct sockaddr*)&addr, sizeof(addr))
+	    || (fd2 = dup(fd)) < 0
+	    || !(this->in = fdopen(fd, "rb"))
+	    || !(this->out = fdopen(fd2, "wb"))) {
+		fprintf(stderr, "Error: unable to connect to %s\n", path);
+		exit(-1);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Starts a server which reads requests from stdin and writes responses to stdout.
+// Returns the server's process ID.
+static pid_t client_exec(client_t *this, const char *path, const char *threads) {
+	int   request[2], response[2];
+	pid_t pid;
+	
+	if (pipe(request) || pipe(response) || (pid = fork()) < 0) {
+		fprintf(stderr, "Error: unable to start %s\n", path);
+		exit(-1);
+	}
+	
+	if (!pid) {
+		dup2(request[0], 0);
+		dup2(response[1], 1);
+		close(request[0]);
+		close(request[1]);
+		close(response[0]);
+		close(response[1]);
+		
+		if (threads)
+			execl(path, path, "-j", threads, (char*)NULL);
+		else
+			execl(path, path, (char*)NULL);
+		fprintf(stderr, "Error: unable to start %s\n", path);
+		_exit(-1);
+	}
+	
+	close(request[0]);
+	close(response[1]);
+	if (!(this->in = fdopen(response[0], "rb")) || !(this->out = fdopen(request[1], "wb"))) {
+		fprintf(stderr, "Error: unable to start %s\n", path);
+		exit(-1);
+	}
+	return pid;
+}
+
+#endif
+
+int main (int argc, char **argv) {
+	client_t    client = {0};
+	const char *socketpath = NULL, *serverpath = "./halserver", *threads = NULL, *outdir = NULL;
+	int i;
+	
+	client.repeat = 1;
+	
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-socket") && i < argc - 1) {
+			socketpath = argv[++i];
+		} else if (!strcmp(argv[i], "-server") && i < argc - 1) {
+			serverpath = argv[++i];
+		} else if (!strcmp(argv[i], "-j") && i < argc - 1) {
+			threads = argv[++i];
+		} else if (!strcmp(argv[i], "-o") && i < argc - 1) {
+			outdir = argv[++i];
+		} else if (!strcmp(argv[i], "-repeat") && i < argc - 1) {
+			client.repeat = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-speed") && i < argc - 1) {
+			client.request.speedweight = strtoul(argv[++i], NULL, 0);
+		} else if (argv[i][1] >= '1' && argv[i][1] <= '4' && !argv[i][2]) {
+			client.request.level = argv[i][1] - '0';
+		} else {
+			break;
+		}
+	}
+	
+	if (i < argc) {
+		if (!strcmp(argv[i], "pack")) client.request.op = SERVER_PACK;
+		else if (!strcmp(argv[i], "unpack")) client.request.op = SERVER_UNPACK;
+		else if (!strcmp(argv[i], "validate")) client.request.op = SERVER_VALIDATE;
+		i++;
+	}
+	
+	if (!client.request.op || i >= argc || !client.repeat) {
+		fprintf(stderr, "halclient - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n"
+		                "Usage:\n%s [options] pack|unpack|validate file...\n\n"
+		                "Sends each file to halserver and reports the results.\n\n"
+		                "Options:\n"
+		                "-socket path  connect to a server listening on a Unix domain socket\n"
+		                "-server path  otherwise, start this server (default ./halserver)\n"
+		                "-j n          number of threads for the server started with -server\n"
+		                "-o dir        save the output for each file to a directory\n"
+		                "-repeat n     send every file n times (to measure throughput)\n"
+		                "-1 to -4      compression level (see inhal)\n"
+		                "-speed n      trade compressed size for decompression time (see inhal)\n",
+		                argv[0]);
+		exit(-1);
+	}
+
+#ifdef _WIN32
+	(void)socketpath; (void)serverpath; (void)threads; (void)outdir;
+	fprintf(stderr, "Error: halclient is not supported on Windows\n");
+	exit(-1);
+#else
+	client.count = argc - i;
+	client.files = calloc(client.count, sizeof(client_file_t));
+	client.sent  = malloc(client.count * client.repeat * sizeof(double));
+	if (!client.files || !client.sent) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	for (size_t j = 0; j < client.count; j++) {
+		client_file_t *file = &client.files[j];
+		FILE *in = fopen(argv[i + j], "rb");
+		
+		file->path = argv[i + j];
+		if (!in || !(file->data = malloc(DATA_SIZE))) {
+			fprintf(stderr, "Error: unable to open %s\n", file->path);
+			exit(-1);
+		}
+		file->size = fread(file->data, 1, DATA_SIZE, in);
+		if (fgetc(in) != EOF) {
+			fprintf(stderr, "Error: %s is larger than 64 kb\n", file->path);
+			exit(-1);
+		}
+		fclose(in);
+	}
+	
+	pid_t pid = 0;
+	if (socketpath)
+		client_connect(&client, socketpath);
+	else
+		pid = client_exec(&client, serverpath, threads);
+	
+	pthread_t sender;
+	double time = timer_now();
+	if (pthread_create(&sender, NULL, client_send, &client)) {
+		fprintf(stderr, "Error: unable to start sending thread\n");
+		exit(-1);
+	}
+	
+	size_t   total = client.count * client.repeat, errors = 0;
+	double  *latency = malloc(total * sizeof(double));
+	uint8_t *data = malloc(DATA_SIZE + 1);
+	uint64_t totalin = 0, totalout = 0;
+	
+	if (!latency || !data) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	for (size_t j = 0; j < total; j++) {
+		uint8_t header[RESPONSE_SIZE];
+		server_response_t response;
+		
+		if (fread(header, 1, RESPONSE_SIZE, client.in) != RESPONSE_SIZE) {
+			fprintf(stderr, "Error: server closed the connection\n");
+			exit(-1);
+		}
+		server_get_response(header, &response);
+		if (response.id >= total || response.size > DATA_SIZE
+		    || fread(data, 1, response.size, client.in) != response.size) {
+			fprintf(stderr, "Error: invalid response from server\n");
+			exit(-1);
+		}
+		latency[j] = timer_now() - client.sent[response.id];
+		
+		// only report on the first copy of each file
+		if (response.id >= client.count) continue;
+		
+		client_file_t *file = &client.files[response.id];
+		if (response.status != SERVER_OK) {
+			data[response.size] = 0;
+			fprintf(stderr, "Error: %s: %s\n", file->path, data);
+			errors++;
+			continue;
+		}
+		
+		printf("%-32s %7u -> %7u bytes\n", file->path,
+		       (unsigned)(response.op == SERVER_PACK ? response.unpackedsize : response.packedsize),
+		       (unsigned)(response.op == SERVER_PACK ? response.packedsize : response.unpackedsize));
+		totalin  += response.op == SERVER_PACK ? response.unpackedsize : response.packedsize;
+		totalout += response.op == SERVER_PACK ? response.packedsize : response.unpackedsize;
+		
+		if (outdir && response.size) {
+			const char *name = strrchr(file->path, '/');
+			char *path = malloc(strlen(outdir) + strlen(file->path) + 2);
+			FILE *out;
+			
+			sprintf(path, "%s/%s", outdir, name ? name + 1 : file->path);
+			if (!(out = fopen(path, "wb")) || fwrite(data, 1, response.size, out) != response.size) {
+				fprintf(stderr, "Error: unable to write %s\n", path);
+				errors++;
+			}
+			if (out) fclose(out);
+			free(path);
+		}
+	}
+	time = timer_now() - time;
+	
+	pthread_join(sender, NULL);
+	fclose(client.out);
+	fclose(client.in);
+	if (pid) waitpid(pid, NULL, 0);
+	
+	qsort(latency, total, sizeof(double), double_compare);
+	printf("\n%u files, %lu -> %lu bytes\n", (unsigned)(client.count - errors),
+	       (unsigned long)totalin, (unsigned long)totalout);
+	printf("%lu requests in %.3f seconds (%.1f per second), latency p50 %.3f ms, p99 %.3f ms\n",
+	       (unsigned long)total, time, total / time,
+	       1000 * latency[total / 2], 1000 * latency[total * 99 / 100]);
+	
+	for (size_t j = 0; j < client.count; j++)
+		free(client.files[j].data);
+	free(client.files);
+	free(client.sent);
+	free(latency);
+	free(data);
+	return errors ? -1 : 0;
+#endif
+}
@@ -0,0 +1,100 @@
+/*
+	sniff compression formats
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include <string.h>
+#include "codec.h"
+
+// max. uncompressed size accepted for LZ10 data (the format itself allows up to 16 mb, but
+// checking that much data at every possible offset would be too slow)
+#define LZ10_MAX_SIZE  (256 * 1024)
+// max. compressed size: header, plus one flag byte for every 8 uncompressed bytes
+#define LZ10_MAX_INPUT (4 + LZ10_MAX_SIZE + LZ10_MAX_SIZE / 8 + 1)
+
+// ------------------------------------------------------------------------------------------------
+static size_t hal_probe(const rom_t *rom, size_t offset, unpack_stats_t *stats, const unpack_options_t *options) {
+	return exhal_unpack2(rom_packed(rom, offset), NULL, stats, options);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks for LZ77 data in the format used by the GBA/DS BIOS (type 10h):
+// a 4-byte header (10h and a 24-bit uncompressed size), followed by groups of one flag byte
+// (most significant bit first) and eight items, each either one uncompressed byte (flag = 0) or a
+// 2-byte back reference (flag = 1) with a 4-bit length - 3 and 12-bit distance - 1.
+// methoduse[0] is set to the number of uncompressed bytes, and methoduse[4] to the number of
+// back references.
+static size_t lz10_probe(const rom_t *rom, size_t offset, unpack_stats_t *stats, const unpack_options_t *options) {
+	const uint8_t *data = rom->data + offset;
+	size_t avail = rom->size - offset;
+	
+	// the BIOS only decompresses from word-aligned addresses
+	if ((offset & 3) || avail < 4 || data[0] != 0x10) return 0;
+	
+	size_t outputsize = data[1] | (data[2] << 8) | (data[3] << 16);
+	if (!outputsize || outputsize > LZ10_MAX_SIZE) return 0;
+	
+	// don't check any further than the max. compressed size allows
+	if (options && options->maxinput && avail > options->maxinput)
+		avail = options->maxinput;
+	
+	size_t inpos = 4, outpos = 0;
+	memset(stats, 0, sizeof(*stats));
+	
+	while (outpos < outputsize) {
+		if (inpos >= avail) return 0;
+		uint8_t flags = data[inpos++];
+		
+		for (int bit = 0; bit < 8 && outpos < outputsize; bit++, flags <<= 1) {
+			if (flags & 0x80) {
+				if (inpos + 2 > avail) return 0;
+				
+				size_t length   = (data[inpos] >> 4) + 3;
+				size_t distance = (((data[inpos] & 0x0F) << 8) | data[inpos + 1]) + 1;
+				if (distance > outpos) return 0;
+				
+				inpos  += 2;
+				outpos += length;
+				stats->methoduse[4]++;
+			} else {
+				if (inpos >= avail) return 0;
+				
+				inpos++;
+				outpos++;
+				stats->methoduse[0]++;
+			}
+		}
+	}
+	
+	// a back reference can't continue past the end of the data
+	if (outpos != outputsize) return 0;
+	if (options && options->minratio > 0 && outputsize < options->minratio * inpos) return 0;
+	
+	stats->inputsize = inpos;
+	return outputsize;
+}
+
+const codec_t codecs[CODEC_COUNT] = {
+	{"hal",  DATA_SIZE,      exhal_scan, hal_probe},
+	{"lz10", LZ10_MAX_INPUT, NULL,       lz10_probe},
+};
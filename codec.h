@@ -0,0 +1,67 @@
+/*
+	sniff compression formats
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _CODEC_H
+#define _CODEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "compress.h"
+#include "rom.h"
+
+// compression formats which sniff can look for
+typedef enum {
+	CODEC_HAL  = 0,
+	CODEC_LZ10 = 1,
+	
+	CODEC_COUNT
+} codec_e;
+
+typedef struct {
+	const char *name;
+	// max. size of compressed data (i.e. how far back a change in the ROM can affect results)
+	size_t maxinput;
+	// optional: finds the size of possibly valid data at every offset in a single pass, which
+	// rules out most offsets before probing them (see exhal_scan). Entries for the last 64 kb of
+	// data are only accurate if the data actually ends there.
+	void (*scan)(const uint8_t *data, size_t size, scan_entry_t *table);
+	// checks for valid compressed data at an offset in a ROM, and sets stats->inputsize (and
+	// possibly stats->methoduse, depending on the format).
+	// Returns the size of the uncompressed data, or 0 if the data isn't valid.
+	size_t (*probe)(const rom_t *rom, size_t offset, unpack_stats_t *stats, const unpack_options_t *options);
+} codec_t;
+
+extern const codec_t codecs[CODEC_COUNT];
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
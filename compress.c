@@ -27,6 +27,7 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "compress.h"
 #include "uthash.h"
@@ -43,6 +44,17 @@ void *memmem(const void *h0, size_t k, const void *n0, size_t l);
 #define RUN_SIZE      32
 #define LONG_RUN_SIZE 1024
 
+// number of files decompressed at once by exhal_unpack_multi,
+// and max number of commands to process from one before moving to the next
+#define MULTI_STREAMS  4
+#define MULTI_COMMANDS 32
+
+#ifdef __GNUC__
+#define prefetch(addr) __builtin_prefetch(addr)
+#else
+#define prefetch(addr)
+#endif
+
 // compression method values for backref_t and rle_t
 typedef enum {
 	rle_8   = 0,
@@ -75,7 +87,7 @@ typedef struct {
 // turn 4 bytes into a single integer for quicker hashing/searching
 #define COMBINE(w, x, y, z) ((w << 24) | (x << 16) | (y << 8) | z)
 
-typedef struct {
+struct exhal_context_s {
 	uint8_t *unpacked;
 	size_t inputsize;
 	uint8_t *packed;
@@ -91,15 +103,55 @@ typedef struct {
 	// index of first locations of byte-tuples used to speed up LZ string search
 	tuple_t *offsets;
 	
-} pack_context_t;
+	// decompression cost model and weight used when optimizing for decompression time
+	const decode_cost_t *cost;
+	unsigned speedweight;
+	
+	// buffers kept between uses of the same context
+	// (entries for the tuple index, and graph nodes used by pack_optimal)
+	tuple_t *tuples;
+	void    *nodes;
+};
+typedef struct exhal_context_s pack_context_t;
 
 // ------------------------------------------------------------------------------------------------
-static pack_context_t* pack_context_alloc(uint8_t *unpacked, size_t inputsize, uint8_t *packed) {
+// Allocates a context which can be used to compress any number of files with exhal_pack3.
+// Returns NULL on failure.
+exhal_context_t* exhal_context_alloc(void) {
 	pack_context_t *this;
 	
+	if (!(this = calloc(1, sizeof(*this)))) return NULL;
+	if (!(this->tuples = malloc(DATA_SIZE * sizeof(tuple_t)))) {
+		free(this);
+		return NULL;
+	}
+	
+	return this;
+}
+
+// ------------------------------------------------------------------------------------------------
+void exhal_context_free(exhal_context_t *this) {
+	if (!this) return;
+	
+	HASH_CLEAR(hh, this->offsets);
+	free(this->tuples);
+	free(this->nodes);
+	free(this);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Prepares a context to compress a new file.
+static int pack_context_reset(pack_context_t *this, uint8_t *unpacked, size_t inputsize, uint8_t *packed) {
+	tuple_t *tuples = this->tuples;
+	void    *nodes  = this->nodes;
+	size_t   numtuples = 0;
+	
 	if (inputsize > DATA_SIZE) return 0;
-	if (!(this = calloc(1, sizeof(*this)))) return 0;
 	
+	HASH_CLEAR(hh, this->offsets);
+	memset(this, 0, sizeof(*this));
+	this->tuples    = tuples;
+	this->nodes     = nodes;
 	this->unpacked  = unpacked;
 	this->inputsize = inputsize;
 	this->packed    = packed;
@@ -112,25 +164,14 @@ static pack_context_t* pack_context_alloc(uint8_t *unpacked, size_t inputsize, u
 		// has this one been indexed already
 		HASH_FIND_INT(this->offsets, &currbytes, tuple);
 		if (!tuple) {
-			tuple = (tuple_t*)malloc(sizeof(tuple_t));
+			tuple = &this->tuples[numtuples++];
 			tuple->bytes = currbytes;
 			tuple->offset = i;
 			HASH_ADD_INT(this->offsets, bytes, tuple);
 		}
 	}
 	
-	return this;
-}
-
-// ------------------------------------------------------------------------------------------------
-static void pack_context_free(pack_context_t* this) {
-	tuple_t *curr, *temp;
-	HASH_ITER(hh, this->offsets, curr, temp) {
-		HASH_DEL(this->offsets, curr);
-		free(curr);
-	}
-	
-	free(this);
+	return 1;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -156,6 +197,48 @@ static inline uint8_t rotate (uint8_t i) {
 	return j;
 }
 
+// ------------------------------------------------------------------------------------------------
+// Rough cycle counts for decompressing data on each platform.
+// None of these were measured or counted from a disassembly of HAL's routines: the SNES table is a
+// hand estimate of a typical 65816 byte-at-a-time loop for each method (one command fetch and
+// dispatch, then a setup and a per-byte cost), and the NES and GB tables are placeholders scaled
+// from it for each CPU, since no NES or GB routine is known yet (see gamenotes.txt).
+// They are only good for comparing compressed data against each other, not as real load times.
+// NES/SNES counts are in CPU cycles, GB counts are in machine cycles.
+const decode_cost_t exhal_decode_costs[PLATFORM_COUNT] = {
+	// 65816 running from SlowROM - hand estimate
+	[PLATFORM_SNES] = {
+		.name = "snes", .clock = 2684658.0,
+		.command = 38, .longcommand = 18, .end = 24,
+		//            raw rle8 rle16 seq  lz  rot  rev
+		.setup   = {  12,  16,  24,  16,  42,  42,  46 },
+		.perbyte = {  20,  12,  11,  16,  24,  58,  26 },
+	},
+	// 2A03 (NTSC) - placeholder, not based on any known routine
+	[PLATFORM_NES] = {
+		.name = "nes", .clock = 1789773.0,
+		.command = 34, .longcommand = 16, .end = 20,
+		//            raw rle8 rle16 seq  lz  rot  rev
+		.setup   = {  10,  14,  22,  14,  38,  38,  44 },
+		.perbyte = {  19,  13,  12,  15,  25,  74,  28 },
+	},
+	// LR35902 - placeholder, not based on any known routine
+	[PLATFORM_GB] = {
+		.name = "gb", .clock = 1048576.0,
+		.command = 16, .longcommand = 7, .end = 10,
+		//            raw rle8 rle16 seq  lz  rot  rev
+		.setup   = {   5,   6,  10,   6,  16,  16,  18 },
+		.perbyte = {  11,   8,   8,  10,  14,  48,  16 },
+	},
+};
+
+// ------------------------------------------------------------------------------------------------
+// Estimates how many cycles the decompression routine needs to process a single command.
+static inline unsigned command_cycles(const decode_cost_t *cost, int method, size_t size, int longcmd) {
+	return cost->command + (longcmd ? cost->longcommand : 0)
+	     + cost->setup[method] + cost->perbyte[method] * size;
+}
+
 // ------------------------------------------------------------------------------------------------
 static inline void rle_candidate(rle_t *candidate, size_t size, uint16_t data, method_e method) {
 	// if this is better than the current candidate, use it
@@ -498,7 +581,34 @@ static void pack_normal(pack_context_t *this, int fast) {
 }
 
 // ------------------------------------------------------------------------------------------------
-static void pack_optimal(pack_context_t *this, int fast) {
+// Returns the length of a graph edge used for optimal compression.
+// This is the size of the compressed data (scaled up by 1000), plus (if optimizing for
+// decompression time) the estimated cycles needed to decompress it, scaled by the speed weight.
+static inline uint64_t path_cost(const pack_context_t *this, size_t outsize, int method, size_t size, int longcmd) {
+	uint64_t cost = (uint64_t)outsize * 1000;
+	
+	if (this->speedweight)
+		cost += (uint64_t)this->speedweight * command_cycles(this->cost, method, size, longcmd);
+	
+	return cost;
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline uint64_t backref_path_cost(const pack_context_t *this, const backref_t *backref) {
+	uint16_t outsize = backref_outsize(backref);
+	// backref methods are decompression commands 4-6
+	return path_cost(this, outsize, backref->method + 4, backref->size, outsize > 3);
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline uint64_t rle_path_cost(const pack_context_t *this, const rle_t *rle) {
+	uint16_t outsize = rle_outsize(rle);
+	// RLE methods are decompression commands 1-3
+	return path_cost(this, outsize, rle->method + 1, rle->size, outsize - (rle->method == rle_16) > 2);
+}
+
+// ------------------------------------------------------------------------------------------------
+static int pack_optimal(pack_context_t *this, int fast) {
 	size_t inputsize = this->inputsize;
 	// backref and RLE compression candidates
 	backref_t backref = {0};
@@ -511,10 +621,11 @@ static void pack_optimal(pack_context_t *this, int fast) {
 		struct node_s *next, *prev;
 		// distance to second neighboring node (first is n+1)
 		size_t neighbor;
-		// graph edge length between this and neighbor (i.e. size of compressed data)
-		size_t length;
+		// graph edge length between this and neighbor
+		// (i.e. size of compressed data, plus decompression time if optimizing for it)
+		uint64_t length;
 		// distance to start of data
-		size_t distance;
+		uint64_t distance;
 		// backref used for compression (else RLE if neighbor > 0)
 		int backref;
 		// RLE data or backref offset
@@ -522,12 +633,16 @@ static void pack_optimal(pack_context_t *this, int fast) {
 		// RLE/backref method used
 		method_e method;
 	} node_t;
-	node_t *nodes = calloc(inputsize+1, sizeof(node_t));
 	node_t *node, *other;
 	
+	// the graph is kept with the context, and always has room for the largest possible input
+	if (!this->nodes && !(this->nodes = malloc((DATA_SIZE+1) * sizeof(node_t)))) return 0;
+	node_t *nodes = (node_t*)this->nodes;
+	memset(nodes, 0, (inputsize+1) * sizeof(node_t));
+	
 	for (this->inpos = 0; this->inpos < inputsize; this->inpos++) {
 		node = nodes+this->inpos;
-		node->distance = 1<<16;
+		node->distance = UINT64_MAX;
 
 		// check for a potential RLE
 		rle_check(this, &rle, fast);
@@ -536,10 +651,20 @@ static void pack_optimal(pack_context_t *this, int fast) {
 			ref_search(this, &backref, fast);
 		else backref.size = 0;
 		
+		uint64_t backref_cost = backref.size ? backref_path_cost(this, &backref) : 0;
+		uint64_t rle_cost     = rle.size >= 2 ? rle_path_cost(this, &rle) : 0;
+		int use_backref;
+		
 		// if the backref is a better candidate, use it
-		if (backref.size > rle.size) {
+		// (when optimizing for decompression time, use whichever one costs less per byte)
+		if (this->speedweight && backref.size && rle.size >= 2)
+			use_backref = backref_cost * rle.size < rle_cost * backref.size;
+		else
+			use_backref = backref.size > rle.size;
+		
+		if (use_backref) {
 			node->neighbor = backref.size;
-			node->length   = backref_outsize(&backref);
+			node->length   = backref_cost;
 			node->method   = backref.method;
 			node->data     = backref.offset;
 			node->backref  = 1;
@@ -547,7 +672,7 @@ static void pack_optimal(pack_context_t *this, int fast) {
 		// or if the RLE is a better candidate, use it instead
 		else if (rle.size >= 2) {
 			node->neighbor = rle.size;
-			node->length   = rle_outsize(&rle);
+			node->length   = rle_cost;
 			node->method   = rle.method;
 			node->data     = rle.data;
 		}
@@ -555,15 +680,23 @@ static void pack_optimal(pack_context_t *this, int fast) {
 	
 	// find shortest path through input
 	nodes[0].distance = 0;
-	nodes[inputsize].distance = 1<<16;
+	nodes[inputsize].distance = UINT64_MAX;
+	
+	// at least 1 literal byte + 1 control byte
+	uint64_t literal_cost = path_cost(this, 2, 0, 1, 0);
+	// a run of literals shares one command, so only the first byte of the run needs to pay for
+	// reading and setting up the command when optimizing for decompression time
+	uint64_t literal_next_cost = 2 * 1000;
+	if (this->speedweight)
+		literal_next_cost += (uint64_t)this->speedweight * this->cost->perbyte[0];
 	
 	for (size_t i = 0; i < inputsize; i++) {
 		node = nodes+i;
-		size_t newdist;
+		uint64_t newdist;
 		
 		// check first neighbor (next byte)
 		other = node+1;
-		newdist = node->distance + 2; // at least 1 literal byte + 1 control byte
+		newdist = node->distance + (i && node->prev == node-1 ? literal_next_cost : literal_cost);
 		if (newdist < other->distance) {
 			other->distance = newdist;
 			other->prev = node;
@@ -579,7 +712,7 @@ static void pack_optimal(pack_context_t *this, int fast) {
 			other->prev = node;
 		}
 	}
-	debug("final distance = %u prev = %04x\n", nodes[inputsize].distance, nodes[inputsize].prev);
+	debug("final distance = %llu prev = %04x\n", (unsigned long long)nodes[inputsize].distance, nodes[inputsize].prev);
 	// create path back from end to start of data
 	for (node = nodes+inputsize; node->prev; node = node->prev) {
 		debug("node = %u prev = %u\n", node-nodes, node->prev-nodes);
@@ -605,7 +738,7 @@ static void pack_optimal(pack_context_t *this, int fast) {
 		}
 	}
 	
-	free(nodes);
+	return 1;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -614,18 +747,39 @@ static void pack_optimal(pack_context_t *this, int fast) {
 // inputsize is the length of the uncompressed data.
 // Returns the size of the compressed data in bytes, or 0 if compression failed.
 size_t exhal_pack2(uint8_t *unpacked, size_t inputsize, uint8_t *packed, const pack_options_t *options) {
+	exhal_context_t *ctx = exhal_context_alloc();
+	size_t outpos = 0;
+	
+	if (ctx) {
+		outpos = exhal_pack3(ctx, unpacked, inputsize, packed, options);
+		exhal_context_free(ctx);
+	}
+	return outpos;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Same as exhal_pack2, but uses a context from exhal_context_alloc instead of allocating a new one.
+// This saves time when compressing many files, but a context can't be used by several threads
+// at once.
+size_t exhal_pack3(exhal_context_t *ctx, uint8_t *unpacked, size_t inputsize, uint8_t *packed,
+                   const pack_options_t *options) {
 	size_t outpos = 0;
 	
 	debug("inputsize = %d\n", inputsize);
 	
-	pack_context_t *ctx = pack_context_alloc(unpacked, inputsize, packed);
-	if (!ctx) return 0;
+	if (!pack_context_reset(ctx, unpacked, inputsize, packed)) return 0;
+	
+	if (options && options->speedweight && options->platform < PLATFORM_COUNT) {
+		ctx->cost        = &exhal_decode_costs[options->platform];
+		ctx->speedweight = options->speedweight;
+	}
 
 	if (inputsize > 0) {
-		if (options && options->optimal)
-			pack_optimal(ctx, options ? options->fast : 0);
-		else
+		if (options && options->optimal) {
+			if (!pack_optimal(ctx, options->fast)) return 0;
+		} else {
 			pack_normal(ctx, options ? options->fast : 0);
+		}
 	}
 		
 	if (write_trailer(ctx)) {
@@ -633,7 +787,6 @@ size_t exhal_pack2(uint8_t *unpacked, size_t inputsize, uint8_t *packed, const p
 		outpos = (size_t)ctx->outpos;
 	}
 
-	pack_context_free(ctx);
 	return outpos;
 }
 
@@ -646,152 +799,405 @@ size_t exhal_pack(uint8_t *unpacked, size_t inputsize, uint8_t *packed, int fast
 }
 
 // ------------------------------------------------------------------------------------------------
-// Decompresses a file of up to 64 kb.
-// unpacked/packed are 65536 byte buffers to read/from write to, 
+// Returns which histogram bucket a value belongs in (i.e. the number of significant bits in it).
+static inline int hist_bucket(uint32_t value) {
+	int bucket = 0;
+	while (value && bucket < HIST_SIZE - 1) {
+		bucket++;
+		value >>= 1;
+	}
+	return bucket;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Processes a single command from the compressed input, writing the decompressed data to unpacked.
+// If unpacked is NULL, all the same size and offset checks are performed, but no output is written.
+// options (if not NULL) can enable stricter checks and collection of detailed statistics.
+// pinpos/poutpos point to the current input/output positions, and are updated after each command.
+// Returns 1 if there are more commands, 0 at the end of the data, or -1 if decompression failed.
+static inline int unpack_command(const uint8_t *packed, uint8_t *unpacked, uint32_t *pinpos, uint32_t *poutpos,
+                                 unpack_stats_t *stats, const unpack_options_t *options) {
+	unpack_ext_stats_t *ext = options ? options->ext : NULL;
+	int strict = options ? options->strict : 0;
+	
+	uint32_t inpos    = *pinpos;
+	uint32_t outpos   = *poutpos;
+	uint32_t outstart = outpos;
+	int32_t  insize   = DATA_SIZE - inpos;
+	
+	uint8_t  input;
+	uint16_t command, length, offset = 0;
+	
+	// read command byte from input
+	if (insize < 1) return -1;
+	input = packed[inpos++];
+	
+	// command 0xff = end of data
+	if (input == 0xFF) {
+		if (ext) for (int i = 0; i < PLATFORM_COUNT; i++)
+			ext->cycles[i] += exhal_decode_costs[i].end;
+		*pinpos = inpos;
+		return 0;
+	}
+	
+	// check if it is a long or regular command, get the command no. and size
+	if ((input & 0xE0) == 0xE0) {
+		if (insize < 1) return -1;
+		
+		command = (input >> 2) & 0x07;
+		// get LSB of length from next byte
+		length = (((input & 0x03) << 8) | packed[inpos++]) + 1;
+	} else {
+		command = input >> 5;
+		length = (input & 0x1F) + 1;
+	}
+	
+	// don't try to decompress > 64kb
+	if (((command == 2) && (outpos + 2*length > DATA_SIZE))
+		 || (outpos + length > DATA_SIZE)) {
+		return -1;
+	}
+	
+	switch (command) {
+	// write uncompressed bytes
+	case 0:
+		if (insize < length) return -1;
+		debug("%06x: writing %u raw bytes\n", inpos, length);
+		if (unpacked)
+			memcpy(&unpacked[outpos], &packed[inpos], length);
+		
+		outpos += length;
+		inpos  += length;
+		break;
+	
+	// 8-bit RLE
+	case 1:
+		if (insize < 1) return -1;
+		debug("%06x: writing %u bytes RLE, value %02x\n", inpos, length, packed[inpos]);
+		if (unpacked)
+			memset(&unpacked[outpos], packed[inpos], length);
+
+		outpos += length;
+		inpos++;
+		break;
+
+	// 16-bit RLE
+	case 2:
+		if (insize < 2) return -1;
+		debug("%06x: writing %u words RLE, value %02x%02x\n", inpos, length, packed[inpos], packed[inpos+1]);
+		if (unpacked) for (int i = 0; i < length; i++) {
+			unpacked[outpos + 2*i]     = packed[inpos];
+			unpacked[outpos + 2*i + 1] = packed[inpos+1];
+		}
+
+		outpos += 2*length;
+		inpos += 2;
+		break;
+
+	// 8-bit increasing sequence
+	case 3:
+		if (insize < 1) return -1;
+		debug("%06x: writing %u bytes sequence RLE, value %02x\n", inpos, length, packed[inpos]);
+		if (unpacked) for (int i = 0; i < length; i++)
+			unpacked[outpos + i] = packed[inpos] + i;
+
+		outpos += length;
+		inpos++;
+		break;
+		
+	// regular backref
+	// (offset is big-endian)
+	case 4:
+	case 7:
+		// 7 isn't a real method number, but it behaves the same as 4 due to a quirk in how
+		// the original decompression routine is programmed. (one of Parasyte's docs confirms
+		// this for GB games as well). let's handle it anyway
+		command = 4;
+
+		if (insize < 2) return -1;
+		
+		offset = (packed[inpos] << 8) | packed[inpos+1];
+		debug("%06x: writing %u byte forward ref to %x\n", inpos, length, offset);
+		
+		if (offset + length > DATA_SIZE) return -1;
+		if (strict && offset >= outpos) return -1;
+		
+		if (unpacked) for (int i = 0; i < length; i++)
+			unpacked[outpos + i] = unpacked[offset + i];
+
+		outpos += length;
+		inpos += 2;
+		break;
+
+	// backref with bit rotation
+	// (offset is big-endian)
+	case 5:
+		if (insize < 2) return -1;
+		
+		offset = (packed[inpos] << 8) | packed[inpos+1];
+		debug("%06x: writing %u byte rotated ref to %x\n", inpos, length, offset);
+		
+		if (offset + length > DATA_SIZE) return -1;
+		if (strict && offset >= outpos) return -1;
+		
+		if (unpacked) for (int i = 0; i < length; i++)
+			unpacked[outpos + i] = rotate(unpacked[offset + i]);
+
+		outpos += length;
+		inpos += 2;
+		break;
+
+	// backwards backref
+	// (offset is big-endian)
+	case 6:
+		if (insize < 2) return -1;
+		
+		offset = (packed[inpos] << 8) | packed[inpos+1];
+		debug("%06x: writing %u byte backward ref to %x\n", inpos, length, offset);
+		
+		if (offset < length - 1) return -1;
+		if (strict && offset >= outpos) return -1;
+		
+		if (unpacked) for (int i = 0; i < length; i++)
+			unpacked[outpos + i] = unpacked[offset - i];
+
+		outpos += length;
+		inpos += 2;
+	}
+	
+	// keep track of how many times each compression method is used
+	if (stats) stats->methoduse[command]++;
+	
+	if (ext) {
+		uint32_t size = outpos - outstart;
+		int longcmd = (input & 0xE0) == 0xE0;
+		
+		ext->methodbytes[command] += size;
+		if (longcmd)
+			ext->longcmds++;
+		else
+			ext->shortcmds++;
+		
+		for (int i = 0; i < PLATFORM_COUNT; i++)
+			ext->cycles[i] += command_cycles(&exhal_decode_costs[i], command, size, longcmd);
+		
+		ext->lengths[hist_bucket(size)]++;
+		if (command == 0) {
+			ext->literals[hist_bucket(size)]++;
+		} else if (command >= 4) {
+			if (offset < outstart)
+				ext->distances[hist_bucket(outstart - offset)]++;
+			else
+				ext->unwrittenrefs++;
+		}
+	}
+	
+	// the end of the data can't be any further than this
+	if (options && options->maxinput && inpos >= options->maxinput) return -1;
+	
+	*pinpos  = inpos;
+	*poutpos = outpos;
+	return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Walks the compressed command stream, writing the decompressed data to unpacked.
+// If unpacked is NULL, all the same size and offset checks are performed, but no output is written.
+// options (if not NULL) can enable stricter checks and collection of detailed statistics.
 // Returns the size of the uncompressed data in bytes or 0 if decompression failed.
-size_t exhal_unpack(uint8_t *packed, uint8_t *unpacked, unpack_stats_t *stats) {
+static inline size_t unpack_stream(const uint8_t *packed, uint8_t *unpacked, unpack_stats_t *stats,
+                                   const unpack_options_t *options) {
+	unpack_ext_stats_t *ext = options ? options->ext : NULL;
 	// current input/output positions
 	uint32_t  inpos = 0;
 	uint32_t  outpos = 0;
-
-	uint8_t  input;
-	uint16_t command, length, offset;
+	int       status;
 	
 	if (stats) memset(stats, 0, sizeof(*stats));
+	if (ext)   memset(ext, 0, sizeof(*ext));
+	
+	while ((status = unpack_command(packed, unpacked, &inpos, &outpos, stats, options)) > 0);
+	if (status < 0) return 0;
+	
+	if (options && options->minratio > 0 && outpos < options->minratio * inpos) return 0;
+
+	if (stats) stats->inputsize = (size_t)inpos;
+
+	return (size_t)outpos;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompresses a file of up to 64 kb.
+// unpacked/packed are 65536 byte buffers to read/from write to, 
+// Returns the size of the uncompressed data in bytes or 0 if decompression failed.
+size_t exhal_unpack(const uint8_t *packed, uint8_t *unpacked, unpack_stats_t *stats) {
+	return unpack_stream(packed, unpacked, stats, NULL);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Same as exhal_unpack, with additional options (see compress.h).
+// unpacked may be NULL, in which case the data is only validated (same as exhal_validate).
+size_t exhal_unpack2(const uint8_t *packed, uint8_t *unpacked, unpack_stats_t *stats, const unpack_options_t *options) {
+	if (unpacked)
+		return unpack_stream(packed, unpacked, stats, options);
+	return unpack_stream(packed, NULL, stats, options);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompresses (or validates) several files of up to 64 kb each.
+// Rather than doing each one from start to finish, short bursts of commands from up to
+// MULTI_STREAMS files are processed in turn, so that each file's work can overlap with
+// waiting on another one's input.
+// Each job's outputsize and stats are set the same way as by exhal_unpack2 with the job's options
+// (or exhal_validate if the job has no output buffer and no options).
+void exhal_unpack_multi(unpack_job_t *jobs, size_t count) {
+	unpack_job_t *active[MULTI_STREAMS];
+	// current input/output positions of each active job
+	uint32_t inpos[MULTI_STREAMS], outpos[MULTI_STREAMS];
+	int      numactive = 0;
+	size_t   next = 0;
 	
-	while (1) {
-		int32_t insize = DATA_SIZE - inpos;
+	while (numactive || next < count) {
+		// start as many new jobs as possible
+		while (numactive < MULTI_STREAMS && next < count) {
+			unpack_job_t *job = &jobs[next++];
+			
+			memset(&job->stats, 0, sizeof(job->stats));
+			if (job->options && job->options->ext)
+				memset(job->options->ext, 0, sizeof(*job->options->ext));
+			job->outputsize = 0;
+			prefetch(job->packed);
+			
+			active[numactive] = job;
+			inpos[numactive]  = 0;
+			outpos[numactive] = 0;
+			numactive++;
+		}
 		
-		// read command byte from input
-		if (insize < 1) return 0;
-		input = packed[inpos++];
+		// process a few commands from each active job
+		for (int i = 0; i < numactive;) {
+			unpack_job_t *job = active[i];
+			uint32_t in = inpos[i], out = outpos[i];
+			int status, commands = 0;
+			
+			if (job->unpacked) {
+				while ((status = unpack_command(job->packed, job->unpacked, &in, &out, &job->stats,
+				                                job->options)) > 0 && ++commands < MULTI_COMMANDS);
+			} else {
+				while ((status = unpack_command(job->packed, NULL, &in, &out, &job->stats,
+				                                job->options)) > 0 && ++commands < MULTI_COMMANDS);
+			}
+			inpos[i]  = in;
+			outpos[i] = out;
+			
+			// fetch the next part of the input while the other jobs are being worked on
+			prefetch(job->packed + in + 64);
+			
+			if (status > 0) {
+				i++;
+				continue;
+			}
+			
+			if (status == 0 && !(job->options && job->options->minratio > 0
+			                     && outpos[i] < job->options->minratio * inpos[i])) {
+				job->stats.inputsize = (size_t)inpos[i];
+				job->outputsize      = (size_t)outpos[i];
+			}
+			
+			// this job is done, move the last active one into its place
+			numactive--;
+			active[i] = active[numactive];
+			inpos[i]  = inpos[numactive];
+			outpos[i] = outpos[numactive];
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks whether a 65536 byte buffer holds valid compressed data, without decompressing it.
+// Returns the size the uncompressed data would have (same as exhal_unpack) or 0 if invalid.
+size_t exhal_validate(const uint8_t *packed, unpack_stats_t *stats) {
+	return unpack_stream(packed, NULL, stats, NULL);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Finds the size of valid compressed data (if any) starting at every offset in a block of data.
+// Whether the data at an offset is valid (and how large it is) only depends on the commands from
+// that offset onward, so this works backwards from the end of the data, using the result for the
+// offset of each command's successor, in a single pass.
+// table must have room for one entry per byte of data. Anything past the end of the data is
+// treated as invalid, which gives the same results as exhal_validate as long as there's at least
+// 64 kb of data after each offset of interest (or the data ends at the end of the file).
+void exhal_scan(const uint8_t *data, size_t size, scan_entry_t *table) {
+	for (size_t i = size; i-- > 0;) {
+		scan_entry_t *entry = &table[i];
+		uint8_t  input = data[i];
+		size_t   next = i + 1;
+		uint32_t command, length, outsize, inputsize, outputsize;
+		uint16_t offset;
+		
+		entry->inputsize  = 0;
+		entry->outputsize = 0;
 		
 		// command 0xff = end of data
-		if (input == 0xFF)
-			break;
+		if (input == 0xFF) {
+			entry->inputsize = 1;
+			continue;
+		}
 		
 		// check if it is a long or regular command, get the command no. and size
 		if ((input & 0xE0) == 0xE0) {
-			if (insize < 1) return 0;
+			if (next >= size) continue;
 			
 			command = (input >> 2) & 0x07;
-			// get LSB of length from next byte
-			length = (((input & 0x03) << 8) | packed[inpos++]) + 1;
+			length = (((input & 0x03) << 8) | data[next++]) + 1;
 		} else {
 			command = input >> 5;
 			length = (input & 0x1F) + 1;
 		}
-		
-		// don't try to decompress > 64kb
-		if (((command == 2) && (outpos + 2*length > DATA_SIZE))
-			 || (outpos + length > DATA_SIZE)) {
-			return 0;
-		}
+		outsize = (command == 2) ? 2*length : length;
 		
 		switch (command) {
-		// write uncompressed bytes
+		// uncompressed bytes
 		case 0:
-			if (insize < length) return 0;
-			debug("%06x: writing %u raw bytes\n", inpos, length);
-			memcpy(&unpacked[outpos], &packed[inpos], length);
-			
-			outpos += length;
-			inpos  += length;
+			next += length;
 			break;
 		
-		// 8-bit RLE
+		// 8-bit RLE / sequence
 		case 1:
-			if (insize < 1) return 0;
-			debug("%06x: writing %u bytes RLE, value %02x\n", inpos, length, packed[inpos]);
-			for (int i = 0; i < length; i++)
-				unpacked[outpos++] = packed[inpos];
-
-			inpos++;
+		case 3:
+			next++;
 			break;
-
+		
 		// 16-bit RLE
 		case 2:
-			if (insize < 2) return 0;
-			debug("%06x: writing %u words RLE, value %02x%02x\n", inpos, length, packed[inpos], packed[inpos+1]);
-			for (int i = 0; i < length; i++) {
-				unpacked[outpos++] = packed[inpos];
-				unpacked[outpos++] = packed[inpos+1];
-			}
-
-			inpos += 2;
+			next += 2;
 			break;
-
-		// 8-bit increasing sequence
-		case 3:
-			if (insize < 1) return 0;
-			debug("%06x: writing %u bytes sequence RLE, value %02x\n", inpos, length, packed[inpos]);
-			for (int i = 0; i < length; i++)
-				unpacked[outpos++] = packed[inpos] + i;
-
-			inpos++;
-			break;
-			
-		// regular backref
-		// (offset is big-endian)
-		case 4:
-		case 7:
-			// 7 isn't a real method number, but it behaves the same as 4 due to a quirk in how
-			// the original decompression routine is programmed. (one of Parasyte's docs confirms
-			// this for GB games as well). let's handle it anyway
-			command = 4;
-
-			if (insize < 2) return 0;
-			
-			offset = (packed[inpos] << 8) | packed[inpos+1];
-			debug("%06x: writing %u byte forward ref to %x\n", inpos, length, offset);
-			
-			if (offset + length > DATA_SIZE) return 0;
-			
-			for (int i = 0; i < length; i++)
-				unpacked[outpos++] = unpacked[offset + i];
-
-			inpos += 2;
-			break;
-
-		// backref with bit rotation
-		// (offset is big-endian)
-		case 5:
-			if (insize < 2) return 0;
-			
-			offset = (packed[inpos] << 8) | packed[inpos+1];
-			debug("%06x: writing %u byte rotated ref to %x\n", inpos, length, offset);
-			
-			if (offset + length > DATA_SIZE) return 0;
-			
-			for (int i = 0; i < length; i++)
-				unpacked[outpos++] = rotate(unpacked[offset + i]);
-
-			inpos += 2;
-			break;
-
-		// backwards backref
-		// (offset is big-endian)
-		case 6:
-			if (insize < 2) return 0;
-			
-			offset = (packed[inpos] << 8) | packed[inpos+1];
-			debug("%06x: writing %u byte backward ref to %x\n", inpos, length, offset);
-			
-			if (offset < length - 1) return 0;
+		
+		// backrefs (same checks as when decompressing)
+		default:
+			if (next + 1 >= size) continue;
 			
-			for (int i = 0; i < length; i++)
-				unpacked[outpos++] = unpacked[offset - i];
-
-			inpos += 2;
+			offset = (data[next] << 8) | data[next+1];
+			if (command == 6) {
+				if (offset < length - 1) continue;
+			} else if (offset + length > DATA_SIZE) {
+				continue;
+			}
+			next += 2;
 		}
 		
-		// keep track of how many times each compression method is used
-		if (stats) stats->methoduse[command]++;
+		// the rest of the data has to be valid too
+		if (next >= size || !table[next].inputsize) continue;
+		
+		// don't try to decompress > 64kb
+		inputsize  = (next - i) + table[next].inputsize;
+		outputsize = outsize + table[next].outputsize;
+		if (inputsize > DATA_SIZE || outputsize > DATA_SIZE) continue;
+		
+		entry->inputsize  = inputsize;
+		entry->outputsize = outputsize;
 	}
-
-	if (stats) stats->inputsize = (size_t)inpos;
-
-	return (size_t)outpos;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -806,3 +1212,16 @@ size_t exhal_unpack_from_file(FILE *file, size_t offset, uint8_t *unpacked, unpa
 		
 	return 0;
 }
+
+// ------------------------------------------------------------------------------------------------
+// Validate data from an offset into a file
+size_t exhal_validate_from_file(FILE *file, size_t offset, unpack_stats_t *stats) {
+	uint8_t packed[DATA_SIZE] = {0};
+	
+	fseek(file, offset, SEEK_SET);
+	fread((void*)packed, DATA_SIZE, 1, file);
+	if (!ferror(file))
+		return exhal_validate(packed, stats);
+		
+	return 0;
+}
@@ -36,11 +36,22 @@ extern "C" {
 
 #define DATA_SIZE     65536
 
+// Change this whenever exhal_pack2 could produce different output for the same input and options
+// (used to tell when previously compressed data is out of date)
+#define EXHAL_PACK_VERSION 2
+
+
 typedef struct {
 	// Speed up compression somewhat by avoiding less common compression methods
 	int fast;
 	// Improve compression ratios by performing a shortest-path search
 	int optimal;
+	// With optimal compression, trade larger output for faster decompression on the target platform:
+	// how many bytes of compressed data are worth saving 1000 cycles of decompression time
+	// (0 = only optimize for size)
+	unsigned speedweight;
+	// Target platform (platform_e) used to estimate decompression time
+	int platform;
 } pack_options_t;
 
 typedef struct {
@@ -50,11 +61,100 @@ typedef struct {
 	size_t inputsize;
 } unpack_stats_t;
 
+// Platforms for which decompression time can be estimated
+typedef enum {
+	PLATFORM_SNES = 0,
+	PLATFORM_NES  = 1,
+	PLATFORM_GB   = 2,
+	
+	PLATFORM_COUNT
+} platform_e;
+
+// Approximate cost (in CPU cycles) of each part of a platform's decompression routine
+typedef struct {
+	const char *name;
+	// CPU clock rate (in Hz) used to convert cycles to time
+	double clock;
+	// Cycles spent reading and dispatching a command, extra cycles for the long form of a command,
+	// and cycles spent handling the end-of-data command
+	unsigned command, longcommand, end;
+	// Cycles spent setting up each compression method, and per byte of output produced by it
+	unsigned setup[7], perbyte[7];
+} decode_cost_t;
+
+extern const decode_cost_t exhal_decode_costs[PLATFORM_COUNT];
+
+// Number of buckets in each histogram in unpack_ext_stats_t.
+// Bucket 0 counts values of zero, bucket n counts values from 2^(n-1) to (2^n)-1.
+#define HIST_SIZE     17
+
+typedef struct {
+	// Number of bytes of output produced by each compression method
+	size_t methodbytes[7];
+	// Number of commands with a short (1-byte) or long (2-byte) command/size header
+	int shortcmds, longcmds;
+	// Histogram of output size of each command
+	int lengths[HIST_SIZE];
+	// Histogram of back reference distances (from the current output position to the offset)
+	int distances[HIST_SIZE];
+	// Number of back references to data which has not been output yet
+	int unwrittenrefs;
+	// Histogram of uncompressed (literal) run lengths
+	int literals[HIST_SIZE];
+	// Estimated number of CPU cycles needed to decompress the data on each platform
+	unsigned long cycles[PLATFORM_COUNT];
+} unpack_ext_stats_t;
+
+typedef struct {
+	// If not NULL, collect detailed statistics about the compressed data here
+	unpack_ext_stats_t *ext;
+	// Fail as soon as a back reference points to data which hasn't been output yet
+	// (useful for quickly ruling out data which isn't actually compressed)
+	int strict;
+	// Fail if the compressed data is larger than this many bytes (0 = no limit besides 64 kb)
+	size_t maxinput;
+	// Fail if the compression ratio (uncompressed size / compressed size) is less than this
+	// (0 = no limit)
+	double minratio;
+} unpack_options_t;
+
+// reusable buffers for compressing multiple files (see exhal_context_alloc)
+typedef struct exhal_context_s exhal_context_t;
+
+// used to decompress multiple files at once
+typedef struct {
+	// Compressed input (65536 bytes, same as exhal_unpack)
+	const uint8_t *packed;
+	// Decompressed output (65536 bytes), or NULL to only validate the input
+	uint8_t *unpacked;
+	// Additional options (or NULL), same as exhal_unpack2
+	const unpack_options_t *options;
+	// Size of the uncompressed data, or 0 if decompression failed
+	size_t outputsize;
+	unpack_stats_t stats;
+} unpack_job_t;
+
+// used by exhal_scan to describe the data starting at each offset
+typedef struct {
+	// Size of compressed/uncompressed data starting at this offset
+	// (inputsize is 0 if the data isn't valid)
+	uint32_t inputsize, outputsize;
+} scan_entry_t;
+
 size_t exhal_pack2 (uint8_t *unpacked, size_t inputsize, uint8_t *packed, const pack_options_t *options);
+size_t exhal_pack3 (exhal_context_t *ctx, uint8_t *unpacked, size_t inputsize, uint8_t *packed,
+                    const pack_options_t *options);
+exhal_context_t* exhal_context_alloc(void);
+void   exhal_context_free(exhal_context_t *ctx);
 size_t exhal_pack  (uint8_t *unpacked, size_t inputsize, uint8_t *packed, int fast);
-size_t exhal_unpack(uint8_t *packed, uint8_t *unpacked, unpack_stats_t *stats);
+size_t exhal_unpack(const uint8_t *packed, uint8_t *unpacked, unpack_stats_t *stats);
+size_t exhal_unpack2(const uint8_t *packed, uint8_t *unpacked, unpack_stats_t *stats, const unpack_options_t *options);
+size_t exhal_validate(const uint8_t *packed, unpack_stats_t *stats);
+void   exhal_unpack_multi(unpack_job_t *jobs, size_t count);
+void   exhal_scan(const uint8_t *data, size_t size, scan_entry_t *table);
 
 size_t exhal_unpack_from_file(FILE *file, size_t offset, uint8_t *unpacked, unpack_stats_t *stats);
+size_t exhal_validate_from_file(FILE *file, size_t offset, unpack_stats_t *stats);
 
 #ifdef EXHAL_OLD_NAMES
 #define pack(...)             exhal_pack(__VA_ARGS__)
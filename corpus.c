@@ -0,0 +1,367 @@
+/*
+	exhal / inhal synthetic test data
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include <string.h>
+#include "corpus.h"
+
+// number of different tiles used to build tile data (the rest are repeated or flipped)
+#define BASE_TILES 16
+
+// ------------------------------------------------------------------------------------------------
+// Returns the next number from a simple (splitmix64) random number generator, so that the
+// same data is generated on every system.
+uint64_t corpus_random(uint64_t *state) {
+	uint64_t value = (*state += 0x9E3779B97F4A7C15ull);
+	
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+	return value ^ (value >> 31);
+}
+
+// ------------------------------------------------------------------------------------------------
+const corpus_class_t* corpus_find(const corpus_class_t *classes, size_t count, const char *name) {
+	for (size_t i = 0; i < count; i++) {
+		if (!strcmp(classes[i].name, name)) return &classes[i];
+	}
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline uint8_t reverse_bits(uint8_t value) {
+	value = (value >> 4) | (value << 4);
+	value = ((value & 0xCC) >> 2) | ((value & 0x33) << 2);
+	return ((value & 0xAA) >> 1) | ((value & 0x55) << 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Draws a tile made of mostly solid rows and rows repeated from the one above, like most
+// real graphics. Each row has one byte for each bitplane.
+static void random_tile(uint8_t *tile, int bpp, uint64_t *rng) {
+	for (int plane = 0; plane < bpp; plane += 2) {
+		uint8_t *rows = tile + 8 * plane;
+		
+		for (int row = 0; row < 8; row++) {
+			uint64_t value = corpus_random(rng);
+			
+			for (int i = 0; i < 2; i++) {
+				uint8_t *out = &rows[2 * row + i];
+				
+				if (row && (value & 3)) {
+					// same as the row above
+					*out = out[-2];
+				} else if (value & 4) {
+					// a solid run of pixels
+					int start = (value >> 8) & 7, length = 1 + ((value >> 12) & 7);
+					*out = (uint8_t)(0xFF00 >> length) >> start;
+				} else {
+					*out = value >> 16;
+				}
+				value >>= 20;
+			}
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates 2bpp or 4bpp tiles: a small set of tiles repeated, mirrored and flipped, with some
+// empty and some unique tiles mixed in.
+static void generate_tiles(uint8_t *out, size_t size, uint64_t seed, int bpp) {
+	uint8_t base[BASE_TILES][32], tile[32];
+	size_t  tilesize = 8 * bpp;
+	uint64_t rng = seed;
+	
+	for (int i = 0; i < BASE_TILES; i++)
+		random_tile(base[i], bpp, &rng);
+	
+	for (size_t pos = 0; pos < size; pos += tilesize) {
+		uint64_t value = corpus_random(&rng);
+		const uint8_t *src = base[(value >> 8) % BASE_TILES];
+		int kind = value % 100;
+		
+		if (kind < 40) {
+			memcpy(tile, src, tilesize);
+		} else if (kind < 55) {
+			// mirrored horizontally (every byte reversed)
+			for (size_t i = 0; i < tilesize; i++)
+				tile[i] = reverse_bits(src[i]);
+		} else if (kind < 70) {
+			// flipped vertically (rows in reverse order)
+			for (size_t plane = 0; plane < tilesize; plane += 16) {
+				for (int row = 0; row < 8; row++) {
+					tile[plane + 2 * row]     = src[plane + 2 * (7 - row)];
+					tile[plane + 2 * row + 1] = src[plane + 2 * (7 - row) + 1];
+				}
+			}
+		} else if (kind < 80) {
+			memset(tile, 0, tilesize);
+		} else {
+			random_tile(tile, bpp, &rng);
+			// sometimes the new tile gets reused later too
+			if (kind < 85) memcpy(base[(value >> 16) % BASE_TILES], tile, tilesize);
+		}
+		
+		memcpy(out + pos, tile, size - pos < tilesize ? size - pos : tilesize);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+static void generate_2bpp(uint8_t *out, size_t size, uint64_t seed) {
+	generate_tiles(out, size, seed, 2);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void generate_4bpp(uint8_t *out, size_t size, uint64_t seed) {
+	generate_tiles(out, size, seed, 4);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates an SNES-style tilemap (16-bit entries with a tile number, palette and flip bits)
+// made of empty areas, tiles numbered in order, repeated rows, and scattered single tiles.
+static void generate_tilemap(uint8_t *out, size_t size, uint64_t seed) {
+	uint64_t rng = seed;
+	uint16_t blank = 0x2000 | (corpus_random(&rng) & 0x3FF);
+	size_t   pos = 0;
+	
+	while (pos + 1 < size) {
+		uint64_t value = corpus_random(&rng);
+		size_t   length = 2 * (4 + (value >> 32) % 29);
+		int      kind = value % 100;
+		
+		if (length > size - pos) length = (size - pos) & ~1;
+		
+		if (kind < 35) {
+			// empty area
+			for (size_t i = 0; i < length; i += 2) {
+				out[pos + i]     = blank;
+				out[pos + i + 1] = blank >> 8;
+			}
+		} else if (kind < 60) {
+			// part of a picture, with each tile numbered in order
+			uint16_t entry = ((value >> 8) & 0x3FF) | ((value >> 10) & 0x1C00) | 0x2000;
+			for (size_t i = 0; i < length; i += 2, entry++) {
+				out[pos + i]     = entry;
+				out[pos + i + 1] = entry >> 8;
+			}
+		} else if (kind < 85 && pos >= 64) {
+			// same as the row above (32 tiles wide)
+			for (size_t i = 0; i < length; i++)
+				out[pos + i] = out[pos + i - 64];
+		} else {
+			for (size_t i = 0; i < length; i += 2) {
+				uint16_t entry = corpus_random(&rng) & 0xE3FF;
+				out[pos + i]     = entry;
+				out[pos + i + 1] = entry >> 8;
+			}
+		}
+		pos += length;
+	}
+	if (pos < size) out[pos] = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates data made mostly of long runs of the same byte (like cleared memory or a solid
+// background), with some short stretches of other data.
+static void generate_clear(uint8_t *out, size_t size, uint64_t seed) {
+	uint64_t rng = seed;
+	size_t   pos = 0;
+	
+	while (pos < size) {
+		uint64_t value = corpus_random(&rng);
+		size_t   length = 16 + (value >> 32) % 497;
+		int      kind = value % 100;
+		
+		if (length > size - pos) length = size - pos;
+		
+		if (kind < 60) {
+			memset(out + pos, kind < 40 ? 0 : (value >> 8) & 0xFF, length);
+		} else if (kind < 75) {
+			// a 16-bit value repeated
+			for (size_t i = 0; i < length; i++)
+				out[pos + i] = (value >> (8 + 8 * (i & 1))) & 0xFF;
+		} else if (kind < 85) {
+			// increasing values
+			for (size_t i = 0; i < length; i++)
+				out[pos + i] = (value >> 8) + i;
+		} else {
+			if (length > 32) length = 32;
+			for (size_t i = 0; i < length; i++)
+				out[pos + i] = corpus_random(&rng) & 0xFF;
+		}
+		pos += length;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates English-like text made of common words, with occasional control codes
+// (line breaks and waits for a button press, as used in dialogue).
+static void generate_text(uint8_t *out, size_t size, uint64_t seed) {
+	static const char *words[] = {
+		"the", "of", "and", "to", "a", "in", "is", "you", "that", "it", "he", "was", "for", "on",
+		"are", "as", "with", "his", "they", "at", "be", "this", "have", "from", "or", "one",
+		"had", "by", "word", "but", "not", "what", "all", "were", "we", "when", "your", "can",
+		"said", "there", "use", "an", "each", "which", "she", "do", "how", "their", "if", "will",
+		"Kirby", "Dream", "Land", "star", "power", "friend", "King", "Dedede", "castle", "sky",
+	};
+	uint64_t rng = seed;
+	size_t   pos = 0, line = 0;
+	
+	while (pos < size) {
+		uint64_t value = corpus_random(&rng);
+		const char *word = words[value % (sizeof(words) / sizeof(words[0]))];
+		
+		for (; *word && pos < size; word++, line++)
+			out[pos++] = *word;
+		
+		if (pos < size) {
+			if (line > 24) {
+				// end of a line (or of a message)
+				out[pos++] = (value >> 8) % 4 ? 0x0A : 0xFE;
+				line = 0;
+			} else {
+				out[pos++] = (value >> 8) % 16 ? ' ' : ',';
+				line++;
+			}
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates random bytes (which can't be compressed at all).
+static void generate_noise(uint8_t *out, size_t size, uint64_t seed) {
+	uint64_t rng = seed;
+	
+	for (size_t pos = 0; pos < size; pos++)
+		out[pos] = corpus_random(&rng) >> 56;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void generate_zero(uint8_t *out, size_t size, uint64_t seed) {
+	(void)seed;
+	memset(out, 0, size);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates the same few random bytes repeated over and over.
+static void generate_period(uint8_t *out, size_t size, uint64_t seed, size_t period) {
+	uint64_t rng = seed;
+	uint64_t value = corpus_random(&rng);
+	
+	for (size_t pos = 0; pos < size; pos++)
+		out[pos] = value >> (8 * (pos % period));
+}
+
+// ------------------------------------------------------------------------------------------------
+static void generate_period2(uint8_t *out, size_t size, uint64_t seed) {
+	generate_period(out, size, seed, 2);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void generate_period3(uint8_t *out, size_t size, uint64_t seed) {
+	generate_period(out, size, seed, 3);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void generate_period4(uint8_t *out, size_t size, uint64_t seed) {
+	generate_period(out, size, seed, 4);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates one long increasing sequence of bytes (which repeats every 256 bytes).
+static void generate_sequence(uint8_t *out, size_t size, uint64_t seed) {
+	uint64_t rng = seed;
+	uint8_t  value = corpus_random(&rng);
+	
+	for (size_t pos = 0; pos < size; pos++)
+		out[pos] = value++;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates one long increasing sequence of 16-bit values.
+static void generate_sequence16(uint8_t *out, size_t size, uint64_t seed) {
+	uint64_t rng = seed;
+	uint16_t value = corpus_random(&rng);
+	
+	for (size_t pos = 0; pos + 1 < size; pos += 2, value++) {
+		out[pos]     = value;
+		out[pos + 1] = value >> 8;
+	}
+	if (size & 1) out[size - 1] = value;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates copies of a single 4bpp tile with one random bit changed in each copy, so every
+// tile almost matches every other one.
+static void generate_neartiles(uint8_t *out, size_t size, uint64_t seed) {
+	uint8_t  base[32];
+	uint64_t rng = seed;
+	
+	random_tile(base, 4, &rng);
+	
+	for (size_t pos = 0; pos < size; pos += 32) {
+		uint8_t  tile[32];
+		uint64_t value = corpus_random(&rng);
+		
+		memcpy(tile, base, 32);
+		tile[value % 32] ^= 1 << ((value >> 8) & 7);
+		memcpy(out + pos, tile, size - pos < 32 ? size - pos : 32);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Generates a short random pattern followed by its reverse, repeated, so that every position
+// has many possible backwards references.
+static void generate_mirror(uint8_t *out, size_t size, uint64_t seed) {
+	uint64_t rng = seed;
+	uint64_t value = corpus_random(&rng);
+	
+	for (size_t pos = 0; pos < size; pos++) {
+		size_t i = pos % 16;
+		out[pos] = value >> (8 * (i < 8 ? i : 15 - i));
+	}
+}
+
+const corpus_class_t corpus_classes[] = {
+	{"tiles2bpp", generate_2bpp},
+	{"tiles4bpp", generate_4bpp},
+	{"tilemap",   generate_tilemap},
+	{"clear",     generate_clear},
+	{"text",      generate_text},
+	{"noise",     generate_noise},
+};
+const size_t corpus_num_classes = sizeof(corpus_classes) / sizeof(corpus_classes[0]);
+
+// data which is unlike real data, but takes the compressor the longest to handle: repeating
+// patterns and sequences give the back reference searches far more matches to check
+const corpus_class_t corpus_pathological[] = {
+	{"zero",       generate_zero},
+	{"period2",    generate_period2},
+	{"period3",    generate_period3},
+	{"period4",    generate_period4},
+	{"sequence",   generate_sequence},
+	{"sequence16", generate_sequence16},
+	{"neartiles",  generate_neartiles},
+	{"mirror",     generate_mirror},
+};
+const size_t corpus_num_pathological = sizeof(corpus_pathological) / sizeof(corpus_pathological[0]);
@@ -0,0 +1,58 @@
+/*
+	exhal / inhal synthetic test data
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _CORPUS_H
+#define _CORPUS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+// a kind of data to generate
+typedef struct {
+	const char *name;
+	// fills a buffer with data, which is always the same for the same size and seed
+	void (*generate)(uint8_t *out, size_t size, uint64_t seed);
+} corpus_class_t;
+
+// data resembling the kinds of things HAL games compress
+extern const corpus_class_t corpus_classes[];
+extern const size_t         corpus_num_classes;
+// data which is unlike real data, but which takes as long as possible to compress
+extern const corpus_class_t corpus_pathological[];
+extern const size_t         corpus_num_pathological;
+
+uint64_t corpus_random(uint64_t *state);
+const corpus_class_t* corpus_find(const corpus_class_t *classes, size_t count, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
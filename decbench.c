@@ -0,0 +1,364 @@
+/*
+	exhal / inhal decompression benchmark
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#include "corpus.h"
+#include "timer.h"
+
+// command numbers, as stored in compressed data
+enum {
+	CMD_RAW   = 0,
+	CMD_RLE8  = 1,
+	CMD_RLE16 = 2,
+	CMD_SEQ   = 3,
+	CMD_LZ    = 4,
+	CMD_ROT   = 5,
+	CMD_REV   = 6,
+	// not a real command; used to build data with a mix of every command
+	CMD_MIX   = 7,
+};
+
+// how back references choose which data to copy
+enum {
+	REF_FAR,
+	// overlapping the data being written (which repeats the last few bytes)
+	REF_NEAR,
+};
+
+// amount of random data written before any back references, so they have something to copy
+#define REF_PREFIX 1024
+
+// a kind of compressed data to test
+typedef struct {
+	const char *name;
+	int command, refmode;
+	// amount of output per command (in bytes)
+	unsigned lengths[5];
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+	{"literal", CMD_RAW,   0,        {1, 8, 32, 128, 1024}},
+	{"rle8",    CMD_RLE8,  0,        {2, 8, 32, 128, 1024}},
+	{"rle16",   CMD_RLE16, 0,        {4, 16, 64, 256, 2048}},
+	{"seq",     CMD_SEQ,   0,        {2, 8, 32, 128, 1024}},
+	{"lz_near", CMD_LZ,    REF_NEAR, {4, 8, 32, 128, 1024}},
+	{"lz_far",  CMD_LZ,    REF_FAR,  {4, 8, 32, 128, 1024}},
+	{"lz_rot",  CMD_ROT,   REF_FAR,  {4, 8, 32, 128, 1024}},
+	{"lz_rev",  CMD_REV,   REF_FAR,  {4, 8, 32, 128, 1024}},
+	{"mix",     CMD_MIX,   REF_FAR,  {0}},
+};
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+// compressed data being built
+typedef struct {
+	uint8_t  packed[DATA_SIZE];
+	size_t   inputsize, outputsize, commands;
+	uint64_t rng;
+} stream_t;
+
+// ------------------------------------------------------------------------------------------------
+// Adds a single command which outputs length bytes (half as many words for 16-bit RLE).
+// Returns 0 if there isn't room for it.
+static int stream_add(stream_t *this, int command, unsigned length, int refmode) {
+	unsigned size = (command == CMD_RLE16 ? length / 2 : length) - 1;
+	unsigned headersize = size >= 32 ? 2 : 1;
+	unsigned datasize = command == CMD_RAW ? length : command == CMD_RLE16 || command >= CMD_LZ ? 2 : 1;
+	
+	// leave room for the end of the data
+	if (this->inputsize + headersize + datasize + 1 > DATA_SIZE
+	    || this->outputsize + length > DATA_SIZE || !length || size >= 1024)
+		return 0;
+	if (command >= CMD_LZ && this->outputsize < length) return 0;
+	
+	uint8_t *out = this->packed + this->inputsize;
+	if (size >= 32) {
+		*out++ = 0xE0 | (command << 2) | (size >> 8);
+		*out++ = size & 0xFF;
+	} else {
+		*out++ = (command << 5) | size;
+	}
+	
+	uint64_t value = corpus_random(&this->rng);
+	size_t   offset = 0;
+	
+	if (command == CMD_REV) {
+		// copies backwards from offset
+		offset = length - 1 + value % (this->outputsize - length + 1);
+	} else if (command >= CMD_LZ && refmode == REF_NEAR) {
+		size_t distance = 1 + value % 16;
+		offset = this->outputsize - (distance < this->outputsize ? distance : this->outputsize);
+	} else if (command >= CMD_LZ) {
+		offset = value % (this->outputsize - length + 1);
+	}
+	
+	if (command == CMD_RAW) {
+		for (unsigned i = 0; i < length; i++)
+			*out++ = corpus_random(&this->rng) >> 56;
+	} else if (command >= CMD_LZ) {
+		*out++ = offset >> 8;
+		*out++ = offset & 0xFF;
+	} else {
+		*out++ = value >> 8;
+		if (command == CMD_RLE16) *out++ = value >> 16;
+	}
+	
+	this->inputsize  += headersize + datasize;
+	this->outputsize += length;
+	this->commands++;
+	return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Adds a random command with a random length, roughly in the same proportions as real data.
+static int stream_add_mixed(stream_t *this) {
+	uint64_t value = corpus_random(&this->rng);
+	unsigned kind = value % 100, length = 4 + (value >> 8) % 29;
+	
+	// a few much longer commands
+	if ((value >> 16) % 16 == 0) length = 33 + (value >> 24) % 224;
+	
+	if (kind < 25) return stream_add(this, CMD_RAW, 1 + (value >> 8) % 16, REF_FAR);
+	if (kind < 40) return stream_add(this, CMD_RLE8, length, REF_FAR);
+	if (kind < 45) return stream_add(this, CMD_RLE16, length & ~1, REF_FAR);
+	if (kind < 50) return stream_add(this, CMD_SEQ, length, REF_FAR);
+	if (kind < 75) return stream_add(this, CMD_LZ, length, REF_FAR);
+	if (kind < 85) return stream_add(this, CMD_LZ, length, REF_NEAR);
+	if (kind < 93) return stream_add(this, CMD_ROT, length, REF_FAR);
+	return stream_add(this, CMD_REV, length, REF_FAR);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Builds as much compressed data as will fit using one kind of command.
+static void stream_build(stream_t *this, const bench_case_t *test, unsigned length, uint64_t seed) {
+	memset(this, 0, sizeof(*this));
+	this->rng = seed;
+	
+	if (test->command >= CMD_LZ) {
+		for (unsigned pos = 0; pos < REF_PREFIX; pos += 32)
+			stream_add(this, CMD_RAW, 32, REF_FAR);
+	}
+	
+	if (test->command == CMD_MIX) {
+		// stop once a few commands in a row don't fit
+		for (int misses = 0; misses < 16;)
+			misses = stream_add_mixed(this) ? 0 : misses + 1;
+	} else {
+		while (stream_add(this, test->command, length, test->refmode));
+	}
+	
+	this->packed[this->inputsize++] = 0xFF;
+}
+
+// ------------------------------------------------------------------------------------------------
+static int double_compare(const void *a, const void *b) {
+	double da = *(const double*)a, db = *(const double*)b;
+	
+	return da < db ? -1 : da > db;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompresses a stream repeatedly for at least mintime seconds, then prints the results as JSON.
+// Returns 0 if the stream doesn't decompress to the expected size.
+static int bench_run(const bench_case_t *test, unsigned length, double mintime, int first) {
+	static stream_t stream;
+	static uint8_t  unpacked[DATA_SIZE];
+	unpack_stats_t  stats;
+	double  times[4096], cycles[4096], total = 0;
+	size_t  runs = 0;
+	
+	stream_build(&stream, test, length, (uint64_t)test->command << 32 | length);
+	
+	// this also warms up the caches before timing anything
+	if (exhal_unpack(stream.packed, unpacked, &stats) != stream.outputsize
+	    || stats.inputsize != stream.inputsize) {
+		fprintf(stderr, "Error: %s data (length %u) did not decompress correctly\n", test->name, length);
+		return 0;
+	}
+	
+	while (runs < 4096 && (runs < 5 || total < mintime)) {
+		double   time = timer_now();
+		uint64_t start = timer_cycles();
+		exhal_unpack(stream.packed, unpacked, NULL);
+		cycles[runs] = (double)(timer_cycles() - start);
+		times[runs]  = timer_now() - time;
+		total += times[runs++];
+	}
+	
+	qsort(times, runs, sizeof(double), double_compare);
+	qsort(cycles, runs, sizeof(double), double_compare);
+	double time = times[runs / 2];
+	
+	printf("%s    {\"command\": \"%s\", \"length\": ", first ? "" : ",\n", test->name);
+	if (length) printf("%u", length);
+	else printf("null");
+	printf(", \"commands\": %lu, \"inputsize\": %lu, \"outputsize\": %lu, \"runs\": %lu, "
+	       "\"mbps\": %.3f, \"ns_per_byte\": %.4f, \"cycles_per_byte\": ",
+	       (unsigned long)stream.commands, (unsigned long)stream.inputsize,
+	       (unsigned long)stream.outputsize, (unsigned long)runs,
+	       stream.outputsize / time / 1000000, 1e9 * time / stream.outputsize);
+	if (TIMER_CYCLES) printf("%.3f}", cycles[runs / 2] / stream.outputsize);
+	else printf("null}");
+	
+	return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks that exhal_unpack_multi gives exactly the same results as exhal_unpack2 for every kind
+// of data (plus a broken copy of each one), with and without output and stricter options.
+// Returns 0 if any results are different.
+static int verify_multi(void) {
+	// with the stricter options, a lot of the data is rejected partway through
+	const unpack_options_t checks[] = {
+		{0},
+		{.strict = 1, .maxinput = 4096},
+		{.minratio = 20.0},
+	};
+	size_t count = 0, failed = 0;
+	
+	for (size_t i = 0; i < NUM_CASES; i++) {
+		for (int j = 0; j < 5 && (j == 0 || cases[i].lengths[j]); j++)
+			count += 2;
+	}
+	
+	stream_t *streams = malloc(count * sizeof(stream_t));
+	unpack_job_t *jobs = calloc(count, sizeof(unpack_job_t));
+	unpack_ext_stats_t *ext = calloc(count, sizeof(unpack_ext_stats_t));
+	unpack_options_t *options = calloc(count, sizeof(unpack_options_t));
+	uint8_t *output = malloc(count * DATA_SIZE), *expected = malloc(DATA_SIZE);
+	if (!streams || !jobs || !ext || !options || !output || !expected) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	count = 0;
+	for (size_t i = 0; i < NUM_CASES; i++) {
+		for (int j = 0; j < 5 && (j == 0 || cases[i].lengths[j]); j++) {
+			stream_build(&streams[count], &cases[i], cases[i].lengths[j], (uint64_t)i << 32 | j);
+			// the same data without the end marker, which runs into garbage and (usually) fails
+			streams[count + 1] = streams[count];
+			streams[count + 1].packed[streams[count].inputsize - 1] = 0x55;
+			count += 2;
+		}
+	}
+	
+	for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); c++) {
+		for (int output_used = 0; output_used < 2; output_used++) {
+			for (size_t i = 0; i < count; i++) {
+				options[i]     = checks[c];
+				options[i].ext = &ext[i];
+				jobs[i].packed   = streams[i].packed;
+				jobs[i].unpacked = output_used ? output + i * DATA_SIZE : NULL;
+				jobs[i].options  = &options[i];
+			}
+			memset(output, 0, count * DATA_SIZE);
+			exhal_unpack_multi(jobs, count);
+			
+			for (size_t i = 0; i < count; i++) {
+				unpack_options_t   single = checks[c];
+				unpack_ext_stats_t singleext;
+				unpack_stats_t     stats;
+				size_t outputsize;
+				
+				single.ext = &singleext;
+				memset(expected, 0, DATA_SIZE);
+				outputsize = exhal_unpack2(streams[i].packed, output_used ? expected : NULL, &stats, &single);
+				
+				// (both sets of extended stats are cleared with memset before being collected)
+				if (outputsize != jobs[i].outputsize || stats.inputsize != jobs[i].stats.inputsize
+				    || memcmp(stats.methoduse, jobs[i].stats.methoduse, sizeof(stats.methoduse))
+				    || memcmp(&singleext, &ext[i], sizeof(singleext))
+				    || (output_used && memcmp(expected, jobs[i].unpacked, DATA_SIZE))) {
+					fprintf(stderr, "Error: exhal_unpack_multi gave different results for data %u "
+					        "(options %u, output %d)\n", (unsigned)i, (unsigned)c, output_used);
+					failed++;
+				}
+			}
+		}
+	}
+	
+	fprintf(stderr, "Checked exhal_unpack_multi against exhal_unpack2 with %u files: %u differences\n",
+	        (unsigned)count, (unsigned)failed);
+	
+	free(streams);
+	free(jobs);
+	free(ext);
+	free(options);
+	free(output);
+	free(expected);
+	return !failed;
+}
+
+int main (int argc, char **argv) {
+	const char *only = NULL;
+	double mintime = 0.05;
+	int ok = 1, first = 1;
+	
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-command") && i < argc - 1) {
+			only = argv[++i];
+		} else if (!strcmp(argv[i], "-time") && i < argc - 1) {
+			mintime = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-verify")) {
+			return verify_multi() ? 0 : -1;
+		} else {
+			fprintf(stderr, "haldecbench - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n"
+			                "Usage:\n%s [-command name] [-time seconds]\n%s -verify\n\n"
+			                "Builds compressed data using one kind of command at a time (and a mix of\n"
+			                "all of them), decompresses each one repeatedly for at least the given time\n"
+			                "(default 0.05 seconds), and prints the results as JSON.\n"
+			                "-verify checks that exhal_unpack_multi gives the same results as\n"
+			                "exhal_unpack2 for all of the same data instead.\n"
+			                "Commands:",
+			                argv[0], argv[0]);
+			for (size_t j = 0; j < NUM_CASES; j++)
+				fprintf(stderr, " %s", cases[j].name);
+			fprintf(stderr, "\n");
+			exit(-1);
+		}
+	}
+	
+	printf("{\n");
+	printf("  \"build\": \"" __DATE__ " " __TIME__ "\",\n");
+	printf("  \"cycles\": %s,\n", TIMER_CYCLES ? "true" : "false");
+	printf("  \"results\": [\n");
+	
+	for (size_t i = 0; i < NUM_CASES; i++) {
+		const bench_case_t *test = &cases[i];
+		
+		if (only && strcmp(only, test->name)) continue;
+		for (int j = 0; j < 5 && (j == 0 || test->lengths[j]); j++) {
+			ok = bench_run(test, test->lengths[j], mintime, first) && ok;
+			first = 0;
+		}
+	}
+	
+	printf("\n  ]\n}\n");
+	return ok ? 0 : -1;
+}
@@ -2,20 +2,20 @@
 	exhal - HAL Laboratory decompression tool
 	
 	Usage:
-	exhal romfile offset outfile
-
+	exhal [-json] romfile offset outfile
+	
 	Copyright (c) 2013 Devin Acker
-
+	
 	Permission is hereby granted, free of charge, to any person obtaining a copy
 	of this software and associated documentation files (the "Software"), to deal
 	in the Software without restriction, including without limitation the rights
 	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
 	copies of the Software, and to permit persons to whom the Software is
 	furnished to do so, subject to the following conditions:
-
+	
 	The above copyright notice and this permission notice shall be included in
 	all copies or substantial portions of the Software.
-
+	
 	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
 	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
 	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
@@ -23,53 +23,412 @@
 	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 	THE SOFTWARE.
-	
+
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "compress.h"
+#include "pool.h"
+#include "rom.h"
+#include "timer.h"
+
+// number of output buffers per thread with -manifest (decompressed data waiting to be written)
+#define BUFFERS_PER_THREAD 4
+
+// one file to extract with -manifest
+typedef struct {
+	size_t offset;
+	char  *path;
+	int    line;
+	
+	size_t outputsize;
+	unpack_stats_t     stats;
+	unpack_ext_stats_t ext;
+	// error message (if anything went wrong)
+	const char *error;
+} extract_entry_t;
+
+// decompressed data waiting to be written
+typedef struct {
+	extract_entry_t *entry;
+	uint8_t *data;
+} extract_output_t;
+
+typedef struct {
+	const rom_t     *rom;
+	extract_entry_t *entries;
+	size_t count, alloc;
+	
+	// output buffers which aren't being used
+	uint8_t **buffers;
+	size_t    numbuffers;
+	// outputs waiting to be written (at most one per buffer)
+	extract_output_t *queue;
+	size_t queuestart, queuecount, queuesize;
+	int    done;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} extract_t;
+
+static const char *method_names[7] = {
+	"raw", "rle8", "rle16", "rleseq", "lz", "lzrot", "lzrev"
+};
+
+// ------------------------------------------------------------------------------------------------
+static void print_histogram_json(const char *name, const int *hist) {
+	printf("  \"%s\": [", name);
+	for (int i = 0; i < HIST_SIZE; i++)
+		printf(i ? ", %i" : "%i", hist[i]);
+	printf("]");
+}
+
+// ------------------------------------------------------------------------------------------------
+static void print_stats_json(size_t offset, size_t outputsize,
+                             const unpack_stats_t *stats, const unpack_ext_stats_t *ext) {
+	printf("{\n");
+	printf("  \"offset\": %lu,\n", (unsigned long)offset);
+	printf("  \"inputsize\": %lu,\n", (unsigned long)stats->inputsize);
+	printf("  \"outputsize\": %lu,\n", (unsigned long)outputsize);
+	printf("  \"methods\": {\n");
+	for (int i = 0; i < 7; i++) {
+		printf("    \"%s\": {\"uses\": %i, \"bytes\": %lu}%s\n", method_names[i],
+		       stats->methoduse[i], (unsigned long)ext->methodbytes[i], i < 6 ? "," : "");
+	}
+	printf("  },\n");
+	printf("  \"shortcmds\": %i,\n", ext->shortcmds);
+	printf("  \"longcmds\": %i,\n", ext->longcmds);
+	printf("  \"unwrittenrefs\": %i,\n", ext->unwrittenrefs);
+	print_histogram_json("lengths", ext->lengths);
+	printf(",\n");
+	print_histogram_json("distances", ext->distances);
+	printf(",\n");
+	print_histogram_json("literals", ext->literals);
+	printf(",\n");
+	printf("  \"decode\": {\n");
+	for (int i = 0; i < PLATFORM_COUNT; i++) {
+		const decode_cost_t *cost = &exhal_decode_costs[i];
+		printf("    \"%s\": {\"cycles\": %lu, \"ms\": %.3f}%s\n", cost->name,
+		       ext->cycles[i], 1000.0 * ext->cycles[i] / cost->clock, i < PLATFORM_COUNT - 1 ? "," : "");
+	}
+	printf("  }\n}\n");
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads a list of offsets to extract. Each line has an offset and (optionally) the name of the
+// file to write the data to, which is otherwise based on the offset (i.e. 070000.bin).
+// Anything after a # is ignored.
+static void extract_read(extract_t *this, const char *path) {
+	FILE *file = fopen(path, "r");
+	char  line[4096];
+	int   linenum = 0;
+	
+	if (!file) {
+		fprintf(stderr, "Error: unable to open %s\n", path);
+		exit(-1);
+	}
+	
+	while (fgets(line, sizeof(line), file)) {
+		char *offset, *name;
+		
+		linenum++;
+		line[strcspn(line, "#\r\n")] = 0;
+		if (!(offset = strtok(line, " \t"))) continue;
+		name = strtok(NULL, " \t");
+		
+		if (this->count == this->alloc) {
+			this->alloc = this->alloc ? 2 * this->alloc : 64;
+			this->entries = realloc(this->entries, this->alloc * sizeof(extract_entry_t));
+			if (!this->entries) {
+				fprintf(stderr, "Error: out of memory\n");
+				exit(-1);
+			}
+		}
+		
+		extract_entry_t *entry = &this->entries[this->count++];
+		memset(entry, 0, sizeof(*entry));
+		entry->offset = strtoul(offset, NULL, 0);
+		entry->line   = linenum;
+		if (name) {
+			entry->path = strdup(name);
+		} else if ((entry->path = malloc(32))) {
+			sprintf(entry->path, "%06lX.bin", (unsigned long)entry->offset);
+		}
+	}
+	
+	fclose(file);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompresses a range of files from a list, several at once using exhal_unpack_multi,
+// and passes them on to the writer thread.
+static void extract_func(void *arg, size_t start, size_t end, int thread) {
+	extract_t *this = (extract_t*)arg;
+	unpack_job_t     jobs[BUFFERS_PER_THREAD];
+	unpack_options_t options[BUFFERS_PER_THREAD];
+	extract_entry_t *entries[BUFFERS_PER_THREAD];
+	uint8_t         *buffers[BUFFERS_PER_THREAD];
+	size_t i = start;
+	
+	while (i < end) {
+		size_t numbuffers, count = 0;
+		
+		// take as many output buffers as are free right now (without holding on to any of them
+		// while waiting, so that every thread can always make progress)
+		pthread_mutex_lock(&this->lock);
+		while (!this->numbuffers)
+			pthread_cond_wait(&this->cond, &this->lock);
+		numbuffers = end - i < BUFFERS_PER_THREAD ? end - i : BUFFERS_PER_THREAD;
+		if (numbuffers > this->numbuffers) numbuffers = this->numbuffers;
+		for (size_t j = 0; j < numbuffers; j++)
+			buffers[j] = this->buffers[--this->numbuffers];
+		pthread_mutex_unlock(&this->lock);
+		
+		for (; i < end && count < numbuffers; i++) {
+			extract_entry_t *entry = &this->entries[i];
+			
+			if (entry->offset >= this->rom->size) {
+				entry->error = "invalid offset";
+				continue;
+			}
+			
+			// back references can read data that hasn't been written yet, which should always be zero
+			memset(buffers[count], 0, DATA_SIZE);
+			memset(&options[count], 0, sizeof(unpack_options_t));
+			memset(&jobs[count], 0, sizeof(unpack_job_t));
+			options[count].ext    = &entry->ext;
+			jobs[count].packed    = rom_packed(this->rom, entry->offset);
+			jobs[count].unpacked  = buffers[count];
+			jobs[count].options   = &options[count];
+			entries[count++]      = entry;
+		}
+		exhal_unpack_multi(jobs, count);
+		
+		pthread_mutex_lock(&this->lock);
+		for (size_t j = 0; j < count; j++) {
+			extract_entry_t *entry = entries[j];
+			
+			entry->outputsize = jobs[j].outputsize;
+			entry->stats      = jobs[j].stats;
+			if (entry->outputsize) {
+				extract_output_t *output = &this->queue[(this->queuestart + this->queuecount++) % this->queuesize];
+				output->entry = entry;
+				output->data  = buffers[j];
+			} else {
+				entry->error = "not valid compressed data";
+				this->buffers[this->numbuffers++] = buffers[j];
+			}
+		}
+		// return any buffers left over from invalid offsets
+		for (size_t j = count; j < numbuffers; j++)
+			this->buffers[this->numbuffers++] = buffers[j];
+		pthread_cond_broadcast(&this->cond);
+		pthread_mutex_unlock(&this->lock);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writes decompressed data to files as it becomes available, so that the other threads can
+// keep decompressing in the meantime.
+static void* extract_writer(void *arg) {
+	extract_t *this = (extract_t*)arg;
+	
+	pthread_mutex_lock(&this->lock);
+	while (1) {
+		while (!this->queuecount && !this->done)
+			pthread_cond_wait(&this->cond, &this->lock);
+		if (!this->queuecount) break;
+		
+		extract_output_t output = this->queue[this->queuestart];
+		this->queuestart = (this->queuestart + 1) % this->queuesize;
+		this->queuecount--;
+		pthread_mutex_unlock(&this->lock);
+		
+		FILE *file = output.entry->path ? fopen(output.entry->path, "wb") : NULL;
+		if (!file) {
+			output.entry->error = "unable to open output file";
+		} else {
+			if (fwrite(output.data, 1, output.entry->outputsize, file) != output.entry->outputsize)
+				output.entry->error = "unable to write output file";
+			if (fclose(file))
+				output.entry->error = "unable to write output file";
+		}
+		
+		pthread_mutex_lock(&this->lock);
+		this->buffers[this->numbuffers++] = output.data;
+		pthread_cond_broadcast(&this->cond);
+	}
+	pthread_mutex_unlock(&this->lock);
+	
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompresses every offset in a list using multiple threads, then outputs a report.
+// Returns the number of files which couldn't be extracted.
+static int extract_all(extract_t *this, int threads, int json) {
+	pthread_t writer;
+	int errors = 0;
+	
+	this->queuesize = threads * BUFFERS_PER_THREAD;
+	this->buffers   = malloc(this->queuesize * sizeof(uint8_t*));
+	this->queue     = malloc(this->queuesize * sizeof(extract_output_t));
+	if (!this->buffers || !this->queue) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (size_t i = 0; i < this->queuesize; i++) {
+		if (!(this->buffers[i] = malloc(DATA_SIZE))) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+	}
+	this->numbuffers = this->queuesize;
+	
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->cond, NULL);
+	if (pthread_create(&writer, NULL, extract_writer, this)) {
+		fprintf(stderr, "Error: unable to start writer thread\n");
+		exit(-1);
+	}
+	
+	double time = timer_now();
+	// hand out as many files at once as each thread has output buffers for
+	pool_run(this->count, BUFFERS_PER_THREAD, threads, extract_func, this);
+	
+	pthread_mutex_lock(&this->lock);
+	this->done = 1;
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->lock);
+	pthread_join(writer, NULL);
+	time = timer_now() - time;
+	
+	pthread_mutex_destroy(&this->lock);
+	pthread_cond_destroy(&this->cond);
+	for (size_t i = 0; i < this->numbuffers; i++)
+		free(this->buffers[i]);
+	free(this->buffers);
+	free(this->queue);
+	
+	size_t totalin = 0, totalout = 0;
+	if (json) printf("[\n");
+	else printf("Offset    Packed Unpacked   Ratio   Cycles File\n");
+	
+	for (size_t i = 0; i < this->count; i++) {
+		extract_entry_t *entry = &this->entries[i];
+		
+		if (entry->error) {
+			fprintf(stderr, "Error: unable to extract 0x%06lX (line %d): %s\n",
+			        (unsigned long)entry->offset, entry->line, entry->error);
+			errors++;
+		} else if (json) {
+			if (totalout) printf(",\n");
+			print_stats_json(entry->offset, entry->outputsize, &entry->stats, &entry->ext);
+		} else {
+			printf("0x%06lX %7lu %8lu %5.2f:1 %8lu %s\n", (unsigned long)entry->offset,
+			       (unsigned long)entry->stats.inputsize, (unsigned long)entry->outputsize,
+			       (double)entry->outputsize / entry->stats.inputsize, entry->ext.cycles[PLATFORM_SNES],
+			       entry->path);
+		}
+		if (!entry->error) {
+			totalin  += entry->stats.inputsize;
+			totalout += entry->outputsize;
+		}
+		free(entry->path);
+	}
+	
+	if (json)
+		printf("]\n");
+	else
+		printf("\n%u files, %lu -> %lu bytes, extracted in %.3f seconds\n",
+		       (unsigned)(this->count - errors), (unsigned long)totalin, (unsigned long)totalout, time);
+	
+	return errors;
+}
 
 int main (int argc, char **argv) {
-	printf("exhal - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n");
+	int json = 0, manifest = 0, threads = 0;
+	
+	for (int i = 1; i < argc - 2; i++) {
+		if (!strcmp(argv[i], "-json")) {
+			json = 1;
+		} else if (!strcmp(argv[i], "-manifest")) {
+			manifest = 1;
+		} else if (!strcmp(argv[i], "-j") && i < argc - 3) {
+			threads = atoi(argv[++i]);
+		}
+	}
+	
+	if (!json)
+		printf("exhal - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n");
 	
-	if (argc != 4) {
-		fprintf(stderr, "Usage:\n%s romfile offset outfile\n"
+	if (argc < 3 || (argc < 4 && !manifest)) {
+		fprintf(stderr, "Usage:\n%s [options] romfile offset outfile\n"
+		                "%s [options] -manifest listfile romfile\n"
 		                "Example: %s kirbybowl.sfc 0x70000 test.bin\n\n"
+		                "Options:\n"
+		                "-json  print detailed statistics as JSON\n"
+		                "-j n   with -manifest, number of threads to use (default: one per CPU)\n\n"
 		                "offset can be in either decimal or hex.\n",
-		                argv[0], argv[0]);
+		                argv[0], argv[0], argv[0]);
 		exit(-1);
 	}
 	
-	FILE   *infile, *outfile;
+	if (manifest) {
+		extract_t extract = {0};
+		
+		extract_read(&extract, argv[argc - 2]);
+		if (!(extract.rom = rom_open(argv[argc - 1], 0))) {
+			fprintf(stderr, "Error: unable to open %s\n", argv[argc - 1]);
+			exit(-1);
+		}
+		if (threads <= 0) threads = pool_default_threads();
+		
+		int errors = extract_all(&extract, threads, json);
+		
+		free(extract.entries);
+		rom_close((rom_t*)extract.rom);
+		return errors ? -1 : 0;
+	}
+	
+	rom_t  *rom;
+	FILE   *outfile;
 	
 	// open ROM file for input
-	infile = fopen(argv[1], "rb");
-	if (!infile) {
-		fprintf(stderr, "Error: unable to open %s\n", argv[1]);
+	rom = rom_open(argv[argc - 3], 0);
+	if (!rom) {
+		fprintf(stderr, "Error: unable to open %s\n", argv[argc - 3]);
 		exit(-1);
 	}
 	
 	// open target file for output
-	outfile = fopen(argv[3], "wb");
+	outfile = fopen(argv[argc - 1], "wb");
 	if (!outfile) {
-		fprintf(stderr, "Error: unable to open %s\n", argv[3]);
+		fprintf(stderr, "Error: unable to open %s\n", argv[argc - 1]);
 		exit(-1);
 	}
 	
 	size_t   outputsize, fileoffset;
 	uint8_t  unpacked[DATA_SIZE] = {0};
 	unpack_stats_t stats;
+	unpack_ext_stats_t ext;
+	unpack_options_t options = {
+		.ext = &ext,
+	};
 	
-	fileoffset = strtol(argv[2], NULL, 0);
+	fileoffset = strtol(argv[argc - 2], NULL, 0);
 	
 	// decompress the file
-	fseek(infile, 0, SEEK_END);
-	if (fileoffset < ftell(infile)) {
-		outputsize = exhal_unpack_from_file(infile, fileoffset, unpacked, &stats);
+	if (fileoffset < rom->size) {
+		outputsize = exhal_unpack2(rom_packed(rom, fileoffset), unpacked, &stats, &options);
 	} else {
 		fprintf(stderr, "Error: Unable to decompress %s because an invalid offset was specified\n"
-		                "       (must be between zero and 0x%lX).\n", argv[1], ftell(infile));
+		                "       (must be between zero and 0x%lX).\n", argv[argc - 3], (unsigned long)rom->size);
 		exit(-1);
 	}
 	
@@ -82,26 +441,39 @@ int main (int argc, char **argv) {
 			exit(-1);
 		}
 		
+		if (json) {
+			print_stats_json(fileoffset, outputsize, &stats, &ext);
+		} else {
 #ifdef EXTRA_OUT
-		printf("Method             Uses\n");
-		printf("No compression   : %i\n", stats.methoduse[0]);
-		printf("RLE (8-bit)      : %i\n", stats.methoduse[1]);
-		printf("RLE (16-bit)     : %i\n", stats.methoduse[2]);
-		printf("RLE (sequence)   : %i\n", stats.methoduse[3]);
-		printf("Backref (normal) : %i\n", stats.methoduse[4]);
-		printf("Backref (rotate) : %i\n", stats.methoduse[5]);
-		printf("Backref (reverse): %i\n", stats.methoduse[6]);
-		printf("\n");
+			printf("Method             Uses   Bytes\n");
+			printf("No compression   : %-6i %lu\n", stats.methoduse[0], (unsigned long)ext.methodbytes[0]);
+			printf("RLE (8-bit)      : %-6i %lu\n", stats.methoduse[1], (unsigned long)ext.methodbytes[1]);
+			printf("RLE (16-bit)     : %-6i %lu\n", stats.methoduse[2], (unsigned long)ext.methodbytes[2]);
+			printf("RLE (sequence)   : %-6i %lu\n", stats.methoduse[3], (unsigned long)ext.methodbytes[3]);
+			printf("Backref (normal) : %-6i %lu\n", stats.methoduse[4], (unsigned long)ext.methodbytes[4]);
+			printf("Backref (rotate) : %-6i %lu\n", stats.methoduse[5], (unsigned long)ext.methodbytes[5]);
+			printf("Backref (reverse): %-6i %lu\n", stats.methoduse[6], (unsigned long)ext.methodbytes[6]);
+			printf("\n");
+			printf("Short commands   : %i\n", ext.shortcmds);
+			printf("Long commands    : %i\n", ext.longcmds);
+			printf("\n");
 #endif
 
-		printf("Compressed size:    %lu bytes\n", (unsigned long)stats.inputsize);
-		printf("Uncompressed size:  %lu bytes\n", (unsigned long)outputsize);
-		printf("Compression ratio:  %4.2f:1\n", (double)outputsize / stats.inputsize);
+			printf("Compressed size:    %lu bytes\n", (unsigned long)stats.inputsize);
+			printf("Uncompressed size:  %lu bytes\n", (unsigned long)outputsize);
+			printf("Compression ratio:  %4.2f:1\n\n", (double)outputsize / stats.inputsize);
+			
+			printf("Estimated decompression time:\n");
+			for (int i = 0; i < PLATFORM_COUNT; i++) {
+				const decode_cost_t *cost = &exhal_decode_costs[i];
+				printf("%-4s: %8lu cycles (%.2f ms)\n", cost->name, ext.cycles[i], 1000.0 * ext.cycles[i] / cost->clock);
+			}
+		}
 	} else {
 		fprintf(stderr, "Error: Unable to decompress %s because the output would have been larger than\n"
-		                "       64 kb. The input at 0x%lX is likely not valid compressed data.\n", argv[1], (unsigned long)fileoffset);
+		                "       64 kb. The input at 0x%lX is likely not valid compressed data.\n", argv[argc - 3], (unsigned long)fileoffset);
 	}
 	
-	fclose(infile);
+	rom_close(rom);
 	fclose(outfile);
 }
@@ -0,0 +1,70 @@
+/*
+	exhal / inhal hashing
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include "hash.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+// ------------------------------------------------------------------------------------------------
+static inline uint64_t rotl64(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads 8 bytes as a little-endian value (so that hashes are the same on every platform).
+static inline uint64_t read64(const uint8_t *bytes) {
+	return (uint64_t)bytes[0]       | ((uint64_t)bytes[1] << 8)
+	     | ((uint64_t)bytes[2] << 16) | ((uint64_t)bytes[3] << 24)
+	     | ((uint64_t)bytes[4] << 32) | ((uint64_t)bytes[5] << 40)
+	     | ((uint64_t)bytes[6] << 48) | ((uint64_t)bytes[7] << 56);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Computes a 64-bit hash of a block of data (using the same rounds as xxHash64).
+// This is only meant for detecting identical data (ROMs, cached results, etc.), not for security.
+uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+	const uint8_t *bytes = (const uint8_t*)data;
+	uint64_t hash = seed + PRIME5 + (uint64_t)size;
+	
+	for (; size >= 8; size -= 8, bytes += 8) {
+		hash ^= rotl64(read64(bytes) * PRIME2, 31) * PRIME1;
+		hash  = rotl64(hash, 27) * PRIME1 + PRIME4;
+	}
+	for (; size; size--, bytes++) {
+		hash ^= *bytes * PRIME5;
+		hash  = rotl64(hash, 11) * PRIME1;
+	}
+	
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
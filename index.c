@@ -0,0 +1,274 @@
+/*
+	sniff result index
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "hash.h"
+#include "index.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static const char index_magic[8] = "SNIFFIDX";
+
+// sizes of the (little-endian) file header and each result
+#define PARAMS_SIZE (4 + 4 + 4 + 8 + 4)
+#define HEADER_SIZE (8 + 4 + 8 + 8 + 8 + 8 + PARAMS_SIZE + 4)
+#define RESULT_SIZE (4 * 11)
+
+// ------------------------------------------------------------------------------------------------
+static uint8_t* put32(uint8_t *out, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		*out++ = value >> (8 * i);
+	return out;
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint8_t* put64(uint8_t *out, uint64_t value) {
+	for (int i = 0; i < 8; i++)
+		*out++ = value >> (8 * i);
+	return out;
+}
+
+// ------------------------------------------------------------------------------------------------
+static const uint8_t* get32(const uint8_t *in, uint32_t *value) {
+	*value = 0;
+	for (int i = 0; i < 4; i++)
+		*value |= (uint32_t)*in++ << (8 * i);
+	return in;
+}
+
+// ------------------------------------------------------------------------------------------------
+static const uint8_t* get64(const uint8_t *in, uint64_t *value) {
+	*value = 0;
+	for (int i = 0; i < 8; i++)
+		*value |= (uint64_t)*in++ << (8 * i);
+	return in;
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint8_t* put_params(uint8_t *out, const sniff_params_t *params) {
+	uint64_t ratio;
+	memcpy(&ratio, &params->minratio, sizeof(ratio));
+	
+	out = put32(out, params->strict);
+	out = put32(out, params->minsize);
+	out = put32(out, params->maxinput);
+	out = put64(out, ratio);
+	return put32(out, params->codecs);
+}
+
+// ------------------------------------------------------------------------------------------------
+static const uint8_t* get_params(const uint8_t *in, sniff_params_t *params) {
+	uint32_t strict;
+	uint64_t ratio;
+	
+	in = get32(in, &strict);
+	in = get32(in, &params->minsize);
+	in = get32(in, &params->maxinput);
+	in = get64(in, &ratio);
+	in = get32(in, &params->codecs);
+	
+	params->strict = strict;
+	memcpy(&params->minratio, &ratio, sizeof(ratio));
+	return in;
+}
+
+// ------------------------------------------------------------------------------------------------
+void index_add(sniff_index_t *this, const sniff_result_t *result) {
+	if (this->count == this->alloc) {
+		this->alloc = this->alloc ? 2 * this->alloc : 16;
+		this->results = realloc(this->results, this->alloc * sizeof(sniff_result_t));
+		if (!this->results) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+	}
+	this->results[this->count++] = *result;
+}
+
+// ------------------------------------------------------------------------------------------------
+void index_free(sniff_index_t *this) {
+	free(this->results);
+	this->results = NULL;
+	this->count = this->alloc = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Loads a previously saved index.
+// Returns 0 if the file couldn't be read or isn't a valid index.
+int index_read(sniff_index_t *this, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) return 0;
+	
+	uint8_t header[HEADER_SIZE], entry[RESULT_SIZE];
+	const uint8_t *in = header;
+	uint32_t version, count;
+	
+	memset(this, 0, sizeof(*this));
+	if (fread(header, 1, HEADER_SIZE, file) != HEADER_SIZE
+	    || memcmp(header, index_magic, sizeof(index_magic)))
+		goto fail;
+	
+	in = get32(in + sizeof(index_magic), &version);
+	if (version != INDEX_VERSION) goto fail;
+	in = get64(in, &this->romhash);
+	in = get64(in, &this->romsize);
+	in = get64(in, &this->start);
+	in = get64(in, &this->end);
+	if (this->start > this->end || this->end > this->romsize) goto fail;
+	in = get_params(in, &this->params);
+	in = get32(in, &count);
+	
+	for (uint32_t i = 0; i < count; i++) {
+		sniff_result_t result;
+		
+		if (fread(entry, 1, RESULT_SIZE, file) != RESULT_SIZE) goto fail;
+		in = get32(entry, &result.offset);
+		in = get32(in, &result.inputsize);
+		in = get32(in, &result.outputsize);
+		in = get32(in, &result.codec);
+		for (int j = 0; j < 7; j++)
+			in = get32(in, &result.methoduse[j]);
+		
+		// results must be in order and inside of the range that was checked
+		if (result.offset < this->start || result.offset >= this->end)
+			goto fail;
+		if (i) {
+			const sniff_result_t *prev = &this->results[i - 1];
+			if (result.offset < prev->offset || (result.offset == prev->offset && result.codec <= prev->codec))
+				goto fail;
+		}
+		index_add(this, &result);
+	}
+	
+	fclose(file);
+	return 1;
+
+fail:
+	fclose(file);
+	index_free(this);
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Saves an index. The file is written under a temporary name first, so that other processes
+// reading the same index (i.e. from a shared cache) never see an incomplete file.
+// Returns 0 on failure.
+int index_write(const sniff_index_t *this, const char *path) {
+	size_t   size = HEADER_SIZE + this->count * RESULT_SIZE;
+	uint8_t *data = malloc(size);
+	char    *temp = malloc(strlen(path) + 32);
+	int      ok = 0;
+	
+	if (!data || !temp) goto done;
+	
+	uint8_t *out = data;
+	memcpy(out, index_magic, sizeof(index_magic));
+	out = put32(out + sizeof(index_magic), INDEX_VERSION);
+	out = put64(out, this->romhash);
+	out = put64(out, this->romsize);
+	out = put64(out, this->start);
+	out = put64(out, this->end);
+	out = put_params(out, &this->params);
+	out = put32(out, this->count);
+	
+	for (size_t i = 0; i < this->count; i++) {
+		const sniff_result_t *result = &this->results[i];
+		
+		out = put32(out, result->offset);
+		out = put32(out, result->inputsize);
+		out = put32(out, result->outputsize);
+		out = put32(out, result->codec);
+		for (int j = 0; j < 7; j++)
+			out = put32(out, result->methoduse[j]);
+	}
+	
+	sprintf(temp, "%s.%ld.tmp", path, (long)getpid());
+	FILE *file = fopen(temp, "wb");
+	if (!file) goto done;
+	
+	ok = fwrite(data, 1, size, file) == size;
+	ok = !fclose(file) && ok;
+
+#ifdef _WIN32
+	ok = ok && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && !rename(temp, path);
+#endif
+	if (!ok) remove(temp);
+
+done:
+	free(data);
+	free(temp);
+	return ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks whether two sets of settings would find the same results.
+int index_params_match(const sniff_params_t *params, const sniff_params_t *other) {
+	return params->strict   == other->strict
+	    && params->minsize  == other->minsize
+	    && params->maxinput == other->maxinput
+	    && params->minratio == other->minratio
+	    && params->codecs   == other->codecs;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks whether two indexes are for the same ROM, range and settings.
+int index_matches(const sniff_index_t *this, const sniff_index_t *other) {
+	return this->romhash == other->romhash
+	    && this->romsize == other->romsize
+	    && this->start   == other->start
+	    && this->end     == other->end
+	    && index_params_match(&this->params, &other->params);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the name of the file in a cache directory where an index for the same ROM and settings
+// would be saved. The name should be freed by the caller.
+char* index_cache_path(const sniff_index_t *this, const char *dir) {
+	uint8_t params[PARAMS_SIZE];
+	char   *path = malloc(strlen(dir) + 64);
+	
+	if (!path) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	put_params(params, &this->params);
+	sprintf(path, "%s/%016" PRIx64 "-%016" PRIx64 ".idx", dir,
+	        this->romhash, hash64(params, sizeof(params), this->romsize));
+	return path;
+}
@@ -0,0 +1,82 @@
+/*
+	sniff result index
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _INDEX_H
+#define _INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+// change this whenever the file format (or the meaning of any results) changes
+#define INDEX_VERSION 3
+
+// a possible location of compressed data
+typedef struct {
+	uint32_t offset, inputsize, outputsize;
+	// compression format (see codec.h)
+	uint32_t codec;
+	// number of times each compression method is used (depending on the format)
+	uint32_t methoduse[7];
+} sniff_result_t;
+
+// settings which affect what results are found
+typedef struct {
+	int      strict;
+	uint32_t minsize, maxinput;
+	double   minratio;
+	// which compression formats were looked for (one bit for each)
+	uint32_t codecs;
+} sniff_params_t;
+
+// a list of results (in order of offset and format) for all or part of a ROM
+typedef struct {
+	// hash and size of the ROM which was scanned
+	uint64_t romhash, romsize;
+	// range of offsets which were checked [start, end)
+	uint64_t start, end;
+	sniff_params_t params;
+	
+	sniff_result_t *results;
+	size_t count, alloc;
+} sniff_index_t;
+
+void  index_add(sniff_index_t *index, const sniff_result_t *result);
+void  index_free(sniff_index_t *index);
+int   index_read(sniff_index_t *index, const char *path);
+int   index_write(const sniff_index_t *index, const char *path);
+int   index_params_match(const sniff_params_t *params, const sniff_params_t *other);
+int   index_matches(const sniff_index_t *index, const sniff_index_t *other);
+char* index_cache_path(const sniff_index_t *index, const char *dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
@@ -2,8 +2,9 @@
 	inhal - HAL Laboratory compression tool
 
 	Usage:
-	inhal [-fast] infile romfile offset
-	inhal -n [-fast] infile outfile
+	inhal [options] infile romfile offset
+	inhal [options] -n infile outfile
+	inhal [options] -manifest listfile romfile
    
 	Copyright (c) 2013 Devin Acker
 
@@ -27,10 +28,361 @@
 	
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "cache.h"
 #include "compress.h"
+#include "patch.h"
+#include "pool.h"
+#include "rom.h"
+#include "timer.h"
+
+// one file to insert with -manifest
+typedef struct {
+	char    *path;
+	size_t   offset;
+	// max. compressed size (0 = limited only by the next file's offset)
+	size_t   slot;
+	pack_options_t options;
+	// line number in the manifest
+	int      line;
+	
+	size_t   inputsize, outputsize;
+	uint8_t *packed;
+	double   time;
+	// was the compressed data reused from the cache?
+	int      cached;
+	unsigned long cycles;
+	// error message (if anything went wrong)
+	const char *error;
+} manifest_entry_t;
+
+typedef struct {
+	manifest_entry_t *entries;
+	size_t count, alloc;
+	
+	// entries in the order they're compressed in
+	manifest_entry_t **order;
+	// directory of previously compressed data (or NULL)
+	const char *cachedir;
+} manifest_t;
+
+// ------------------------------------------------------------------------------------------------
+// Handles a compression option from the command line (or a manifest).
+// Returns 1 and moves *i past the option (and its value, if any) if it was one.
+static int pack_option(char **args, int count, int *i, pack_options_t *options) {
+	const char *arg = args[*i];
+	
+	if (!strcmp(arg, "-fast")) {
+		options->fast = 1;
+	} else if (!strcmp(arg, "-opt")) {
+		options->optimal = 1;
+	} else if (!strcmp(arg, "-1")) {
+		options->fast = 1;
+		options->optimal = 0;
+	} else if (!strcmp(arg, "-2")) {
+		options->fast = 0;
+		options->optimal = 0;
+	} else if (!strcmp(arg, "-3")) {
+		options->fast = 1;
+		options->optimal = 1;
+	} else if (!strcmp(arg, "-4")) {
+		options->fast = 0;
+		options->optimal = 1;
+	} else if (!strcmp(arg, "-speed") && *i < count - 1) {
+		options->speedweight = strtoul(args[++*i], NULL, 0);
+	} else if (!strcmp(arg, "-platform") && *i < count - 1) {
+		const char *name = args[++*i];
+		for (options->platform = 0; options->platform < PLATFORM_COUNT; options->platform++) {
+			if (!strcmp(name, exhal_decode_costs[options->platform].name)) break;
+		}
+		if (options->platform == PLATFORM_COUNT) {
+			fprintf(stderr, "Error: unknown platform %s\n", name);
+			exit(-1);
+		}
+	} else {
+		return 0;
+	}
+	
+	return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads a list of files to insert. Each line has an input file, an offset, and optionally the
+// max. compressed size ("-" for no limit) and compression options for that file, e.g.:
+//   gfx/title.chr  0x70000  0x1800  -4
+// Anything after a # is ignored.
+static void manifest_read(manifest_t *this, const char *path, const pack_options_t *options) {
+	FILE *file = fopen(path, "r");
+	char  line[4096];
+	int   linenum = 0;
+	
+	if (!file) {
+		fprintf(stderr, "Error: unable to open %s\n", path);
+		exit(-1);
+	}
+	
+	while (fgets(line, sizeof(line), file)) {
+		char *args[64];
+		int   count = 0;
+		
+		linenum++;
+		line[strcspn(line, "#\r\n")] = 0;
+		for (char *arg = strtok(line, " \t"); arg && count < 64; arg = strtok(NULL, " \t"))
+			args[count++] = arg;
+		if (!count) continue;
+		
+		if (count < 2) {
+			fprintf(stderr, "Error: %s line %d: missing offset\n", path, linenum);
+			exit(-1);
+		}
+		
+		if (this->count == this->alloc) {
+			this->alloc = this->alloc ? 2 * this->alloc : 64;
+			this->entries = realloc(this->entries, this->alloc * sizeof(manifest_entry_t));
+			if (!this->entries) {
+				fprintf(stderr, "Error: out of memory\n");
+				exit(-1);
+			}
+		}
+		
+		manifest_entry_t *entry = &this->entries[this->count++];
+		memset(entry, 0, sizeof(*entry));
+		entry->path    = strdup(args[0]);
+		entry->offset  = strtoul(args[1], NULL, 0);
+		entry->options = *options;
+		entry->line    = linenum;
+		
+		int i = 2;
+		if (i < count && args[i][0] != '-') {
+			entry->slot = strtoul(args[i], NULL, 0);
+			i++;
+		} else if (i < count && !strcmp(args[i], "-")) {
+			i++;
+		}
+		
+		for (; i < count; i++) {
+			if (!pack_option(args, count, &i, &entry->options)) {
+				fprintf(stderr, "Error: %s line %d: unknown option %s\n", path, linenum, args[i]);
+				exit(-1);
+			}
+		}
+	}
+	
+	fclose(file);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads and compresses a range of files from a manifest.
+static void manifest_pack(void *arg, size_t start, size_t end, int thread) {
+	manifest_t *this = (manifest_t*)arg;
+	uint8_t unpacked[DATA_SIZE];
+	
+	for (size_t i = start; i < end; i++) {
+		manifest_entry_t *entry = this->order[i];
+		FILE *file = fopen(entry->path, "rb");
+		
+		if (!file) {
+			entry->error = "unable to open file";
+			continue;
+		}
+		entry->inputsize = fread(unpacked, 1, DATA_SIZE, file);
+		if (ferror(file)) {
+			entry->error = "unable to read file";
+		} else if (!entry->inputsize) {
+			entry->error = "file is empty";
+		} else if (fgetc(file) != EOF) {
+			entry->error = "file is larger than 64 kb";
+		}
+		fclose(file);
+		if (entry->error) continue;
+		
+		if (!(entry->packed = calloc(1, DATA_SIZE))) {
+			entry->error = "out of memory";
+			continue;
+		}
+		
+		double time = timer_now();
+		if (this->cachedir)
+			entry->outputsize = cache_pack(this->cachedir, unpacked, entry->inputsize, entry->packed,
+			                               &entry->options, &entry->cached);
+		else
+			entry->outputsize = exhal_pack2(unpacked, entry->inputsize, entry->packed, &entry->options);
+		entry->time = timer_now() - time;
+		
+		if (!entry->outputsize) {
+			entry->error = "compressed data would be larger than 64 kb";
+			continue;
+		}
+		
+		unpack_ext_stats_t ext;
+		unpack_options_t unpack_options = {
+			.ext = &ext,
+		};
+		if (exhal_unpack2(entry->packed, NULL, NULL, &unpack_options))
+			entry->cycles = ext.cycles[entry->options.platform];
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+static int entry_size_compare(const void *a, const void *b) {
+	const manifest_entry_t *ea = *(manifest_entry_t* const*)a, *eb = *(manifest_entry_t* const*)b;
+	
+	// compress the slowest (largest) files first
+	if (ea->inputsize != eb->inputsize) return ea->inputsize > eb->inputsize ? -1 : 1;
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static int entry_offset_compare(const void *a, const void *b) {
+	const manifest_entry_t *ea = *(manifest_entry_t* const*)a, *eb = *(manifest_entry_t* const*)b;
+	
+	if (ea->offset != eb->offset) return ea->offset < eb->offset ? -1 : 1;
+	return ea->line < eb->line ? -1 : 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compresses every file in a manifest in parallel, makes sure they all fit where they're supposed
+// to go, then writes all of them to the ROM (or adds them to a patch, if patch isn't NULL).
+// Nothing is written unless every file can be inserted.
+static void manifest_insert(manifest_t *this, rom_t *rom, patch_t *patch, int threads) {
+	manifest_entry_t **order = malloc((this->count ? this->count : 1) * sizeof(manifest_entry_t*));
+	int errors = 0, cached = 0;
+	
+	if (!order) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	// find the size of each file first, so the largest ones can be started first
+	for (size_t i = 0; i < this->count; i++) {
+		FILE *file = fopen(this->entries[i].path, "rb");
+		if (file) {
+			fseek(file, 0, SEEK_END);
+			this->entries[i].inputsize = ftell(file);
+			fclose(file);
+		}
+		order[i] = &this->entries[i];
+	}
+	qsort(order, this->count, sizeof(manifest_entry_t*), entry_size_compare);
+	
+	double time = timer_now();
+	this->order = order;
+	pool_run(this->count, 1, threads, manifest_pack, this);
+	time = timer_now() - time;
+	
+	// check that each file fits in its slot and doesn't overlap the next one
+	qsort(order, this->count, sizeof(manifest_entry_t*), entry_offset_compare);
+	for (size_t i = 0; i < this->count; i++) {
+		manifest_entry_t *entry = order[i];
+		if (entry->error) continue;
+		
+		if (entry->slot && entry->outputsize > entry->slot) {
+			entry->error = "compressed data is larger than its slot";
+		} else if (i + 1 < this->count && entry->offset + entry->outputsize > order[i + 1]->offset) {
+			entry->error = "compressed data overlaps the next file";
+		} else if (i + 1 < this->count && entry->slot && entry->offset + entry->slot > order[i + 1]->offset) {
+			entry->error = "slot overlaps the next file";
+		}
+	}
+	
+	printf("%-32s %-8s %-8s %7s %7s %7s %9s %8s\n",
+	       "File", "Offset", "Slot", "Input", "Output", "Ratio", "Time (s)", "Cycles");
+	
+	size_t totalin = 0, totalout = 0;
+	for (size_t i = 0; i < this->count; i++) {
+		manifest_entry_t *entry = order[i];
+		char slot[16] = "-";
+		
+		if (entry->slot) sprintf(slot, "0x%06X", (unsigned)entry->slot);
+		
+		if (entry->error) {
+			printf("%-32s 0x%06X %-8s  Error: %s (line %d)\n", entry->path, (unsigned)entry->offset, slot,
+			       entry->error, entry->line);
+			errors++;
+		} else {
+			printf("%-32s 0x%06X %-8s %7u %7u %5.2f:1 %9.3f %8lu\n", entry->path, (unsigned)entry->offset,
+			       slot, (unsigned)entry->inputsize, (unsigned)entry->outputsize,
+			       (double)entry->inputsize / entry->outputsize, entry->time, entry->cycles);
+			totalin  += entry->inputsize;
+			totalout += entry->outputsize;
+			cached   += entry->cached;
+		}
+	}
+	printf("\n%u files, %u -> %u bytes, compressed in %.3f seconds\n",
+	       (unsigned)this->count, (unsigned)totalin, (unsigned)totalout, time);
+	if (this->cachedir)
+		printf("%d of %u files reused from the cache\n", cached, (unsigned)this->count);
+	
+	if (errors) {
+		fprintf(stderr, "Error: %d file(s) could not be inserted, so nothing was written\n", errors);
+		exit(-1);
+	}
+	
+	// write everything starting from the end, so that the ROM only needs to be enlarged once
+	for (size_t i = this->count; i-- > 0;) {
+		manifest_entry_t *entry = order[i];
+		
+		if (patch) {
+			if (!patch_add(patch, entry->offset, entry->packed, entry->outputsize)) {
+				fprintf(stderr, "Error: out of memory\n");
+				exit(-1);
+			}
+		} else if (!rom_write(rom, entry->offset, entry->packed, entry->outputsize)) {
+			fprintf(stderr, "Error writing output file\n");
+			exit(-1);
+		}
+	}
+	
+	for (size_t i = 0; i < this->count; i++) {
+		free(this->entries[i].path);
+		free(this->entries[i].packed);
+	}
+	free(order);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writes the changes that would have been made to a ROM to a patch file instead.
+static void write_patch(patch_t *patch, const rom_t *rom, const char *path, patch_format_e format) {
+	const char *error = patch_write(patch, rom, path, format);
+	
+	if (error) {
+		fprintf(stderr, "Error: %s\n", error);
+		exit(-1);
+	}
+	printf("Wrote %s patch to %s\n", format == PATCH_BPS ? "BPS" : "IPS", path);
+	patch_free(patch);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Applies an IPS or BPS patch to a ROM.
+static void apply_patch(const char *path, const char *rompath) {
+	rom_t *patch = rom_open(path, 0);
+	rom_t *rom;
+	const char *error;
+	
+	if (!patch) {
+		fprintf(stderr, "Error: unable to open patch file\n");
+		exit(-1);
+	}
+	if (!(rom = rom_open(rompath, 1))) {
+		fprintf(stderr, "Error: unable to open output file\n");
+		exit(-1);
+	}
+	
+	if ((error = patch_apply(rom, patch->data, patch->size))) {
+		fprintf(stderr, "Error: %s\n", error);
+		exit(-1);
+	}
+	printf("Applied %s to %s\n", path, rompath);
+	
+	rom_close(rom);
+	rom_close(patch);
+}
 
 int main (int argc, char **argv) {
 	printf("inhal - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n");
@@ -41,6 +393,12 @@ int main (int argc, char **argv) {
 
 		                "To write compressed data to a new file:\n"
 		                "%s [options] -n infile outfile\n\n"
+		
+		                "To insert several files listed in a manifest into a ROM:\n"
+		                "%s [options] -manifest listfile romfile\n\n"
+		
+		                "To apply an IPS or BPS patch to a ROM:\n"
+		                "%s -apply patchfile romfile\n\n"
 
 		                "Compression options:\n"
 		                "-fast  avoid less common compression methods (faster compression, but larger output)\n"
@@ -50,45 +408,87 @@ int main (int argc, char **argv) {
 		                "-2     fast compression (default)\n"
 		                "-3     better compression (same as -fast -opt)\n"
 		                "-4     best compression (same as -opt)\n"
+		                "\n"
+		                "-speed n     with -opt, trade up to n bytes of output for every 1000 cycles of\n"
+		                "             estimated decompression time saved (default 0)\n"
+		                "-platform p  platform used to estimate decompression time (snes, nes or gb; default snes)\n"
+		                "-j n         with -manifest, number of threads to use (default: one per CPU)\n"
+		                "-cache dir   reuse previously compressed data saved in a directory\n"
+		                "-cachesize n max. size of the cache directory in megabytes (default 256)\n"
+		                "-ips file    write an IPS patch instead of changing the ROM\n"
+		                "-bps file    write a BPS patch instead of changing the ROM\n"
 
 		                "\nExample:\n%s -fast test.chr kirbybowl.sfc 0x70000\n"
 		                "%s -n test.chr test-packed.bin\n\n"
 		                "offset can be in either decimal or hex.\n",
-		                argv[0], argv[0], argv[0], argv[0]);
+		                argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 		exit(-1);
 	}
 	
-	FILE   *infile, *outfile;
+	FILE   *infile, *outfile = NULL;
+	rom_t  *rom = NULL;
 	int    fileoffset;
-	int    newfile = 0;
-	pack_options_t options;
+	int    newfile = 0, manifest = 0, threads = 0, cached = 0;
+	const char *cachedir = NULL, *patchpath = NULL;
+	uint64_t    cachesize = CACHE_DEFAULT_SIZE;
+	patch_t     patch = {0};
+	patch_format_e patchformat = PATCH_IPS;
+	pack_options_t options = {0};
 	
 	for (int i = 1; i < argc; i++) {
 		if (!strcmp(argv[i], "-n")) {
 			newfile = 1;
-		} else if (!strcmp(argv[i], "-fast")) {
-			options.fast = 1;
-		} else if (!strcmp(argv[i], "-opt")) {
-			options.optimal = 1;
-		} else if (!strcmp(argv[i], "-1")) {
-			options.fast = 1;
-			options.optimal = 0;
-		} else if (!strcmp(argv[i], "-2")) {
-			options.fast = 0;
-			options.optimal = 0;
-		} else if (!strcmp(argv[i], "-3")) {
-			options.fast = 1;
-			options.optimal = 1;
-		} else if (!strcmp(argv[i], "-4")) {
-			options.fast = 0;
-			options.optimal = 1;
+		} else if (!strcmp(argv[i], "-manifest")) {
+			manifest = 1;
+		} else if (!strcmp(argv[i], "-j") && i < argc - 1) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-cache") && i < argc - 1) {
+			cachedir = argv[++i];
+		} else if (!strcmp(argv[i], "-cachesize") && i < argc - 1) {
+			cachesize = strtoull(argv[++i], NULL, 0) << 20;
+		} else if ((!strcmp(argv[i], "-ips") || !strcmp(argv[i], "-bps")) && i < argc - 1) {
+			patchformat = strcmp(argv[i], "-bps") ? PATCH_IPS : PATCH_BPS;
+			patchpath = argv[++i];
+		} else if (!strcmp(argv[i], "-apply") && i < argc - 2) {
+			apply_patch(argv[i + 1], argv[i + 2]);
+			return 0;
+		} else {
+			pack_option(argv, argc, &i, &options);
 		}
 	}
+	// a patch is made against an existing ROM, so there has to be one
+	if (newfile && patchpath) {
+		fprintf(stderr, "Error: -ips and -bps can't be used with -n\n");
+		exit(-1);
+	}
 	
 	if (options.fast)
 		printf("Fast compression enabled.\n");
 	if (options.optimal)
 		printf("Optimal compression (shortest path) enabled.\n");	
+	if (options.optimal && options.speedweight)
+		printf("Optimizing for decompression time on %s (weight %u).\n",
+		       exhal_decode_costs[options.platform].name, options.speedweight);
+	
+	if (manifest) {
+		manifest_t list = {0};
+		
+		manifest_read(&list, argv[argc - 2], &options);
+		list.cachedir = cachedir;
+		if (!(rom = rom_open(argv[argc - 1], !patchpath))) {
+			fprintf(stderr, "Error: unable to open output file\n");
+			exit(-1);
+		}
+		if (threads <= 0) threads = pool_default_threads();
+		
+		manifest_insert(&list, rom, patchpath ? &patch : NULL, threads);
+		if (patchpath) write_patch(&patch, rom, patchpath, patchformat);
+		if (cachedir) cache_trim(cachedir, cachesize);
+		
+		free(list.entries);
+		rom_close(rom);
+		return 0;
+	}
 	
 	// check for -n switch
 	if (newfile) {
@@ -98,14 +498,14 @@ int main (int argc, char **argv) {
 	} else {
 		fileoffset = strtol(argv[argc - 1], NULL, 0);
 		infile = fopen(argv[argc - 3], "rb");
-		outfile = fopen(argv[argc - 2], "r+b");
+		rom = rom_open(argv[argc - 2], !patchpath);
 	}
 	
 	if (!infile) {
 		fprintf(stderr, "Error: unable to open input file\n");
 		exit(-1);
 	}
-	if (!outfile) {
+	if (!outfile && !rom) {
 		fprintf(stderr, "Error: unable to open output file\n");
 		exit(-1);
 	}
@@ -138,28 +538,61 @@ int main (int argc, char **argv) {
 	
 	// compress the file
 	clock_t time = clock();
-	outputsize = exhal_pack2(unpacked, inputsize, packed, &options);
+	if (cachedir)
+		outputsize = cache_pack(cachedir, unpacked, inputsize, packed, &options, &cached);
+	else
+		outputsize = exhal_pack2(unpacked, inputsize, packed, &options);
 	time = clock() - time;
 
 	if (outputsize) {
 		// write the compressed data to the file
-		fseek(outfile, fileoffset, SEEK_SET);
-		fwrite((const void*)packed, 1, outputsize, outfile);
-		if (ferror(outfile)) {
-			perror("Error writing output file");
-			exit(-1);
+		// (when inserting into a ROM, only the compressed data itself is written)
+		if (rom && patchpath) {
+			if (!patch_add(&patch, fileoffset, packed, outputsize)) {
+				fprintf(stderr, "Error: out of memory\n");
+				exit(-1);
+			}
+			write_patch(&patch, rom, patchpath, patchformat);
+		} else if (rom) {
+			if (!rom_write(rom, fileoffset, packed, outputsize)) {
+				fprintf(stderr, "Error writing output file\n");
+				exit(-1);
+			}
+		} else {
+			fwrite((const void*)packed, 1, outputsize, outfile);
+			if (ferror(outfile)) {
+				perror("Error writing output file");
+				exit(-1);
+			}
 		}
 		
 		printf("Compressed size:    %lu bytes\n", (unsigned long)outputsize);
 		printf("Compression ratio:  %4.2f:1\n", (double)inputsize / outputsize);
-		printf("Compression time:   %4.3f seconds\n\n", (double)time / CLOCKS_PER_SEC);
+		printf("Compression time:   %4.3f seconds%s\n\n", (double)time / CLOCKS_PER_SEC,
+		       cached ? " (reused from cache)" : "");
+		
+		// estimate how long the data will take to decompress on the target hardware
+		unpack_ext_stats_t ext;
+		unpack_options_t unpack_options = {
+			.ext = &ext,
+		};
+		if (exhal_unpack2(packed, NULL, NULL, &unpack_options)) {
+			printf("Estimated decompression time:\n");
+			for (int i = 0; i < PLATFORM_COUNT; i++) {
+				const decode_cost_t *cost = &exhal_decode_costs[i];
+				printf("%-4s: %8lu cycles (%.2f ms)\n", cost->name, ext.cycles[i], 1000.0 * ext.cycles[i] / cost->clock);
+			}
+			printf("\n");
+		}
 		
-		printf("Inserted at 0x%06X - 0x%06lX\n", fileoffset, ftell(outfile) - 1);
+		printf("Inserted at 0x%06X - 0x%06lX\n", fileoffset, (unsigned long)(fileoffset + outputsize - 1));
 	} else {
 		fprintf(stderr, "Error: File could not be compressed because the resulting compressed data would\n"
 		                "       have been larger than 64 kb.\n");
 	}
 	
 	fclose(infile);
-	fclose(outfile);
+	if (outfile) fclose(outfile);
+	rom_close(rom);
+	if (cachedir) cache_trim(cachedir, cachesize);
 }
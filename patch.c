@@ -0,0 +1,496 @@
+/*
+	exhal / inhal IPS and BPS patches
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "patch.h"
+
+// IPS records can't start at this offset, since it would be read as the end of the patch
+#define IPS_EOF       0x454F46
+#define IPS_MAX_SIZE  0x1000000
+#define IPS_MAX_CHUNK 0xFFFF
+
+// BPS patch commands
+enum {
+	BPS_SOURCE_READ = 0,
+	BPS_TARGET_READ = 1,
+	BPS_SOURCE_COPY = 2,
+	BPS_TARGET_COPY = 3,
+};
+
+// a patch file being built in memory
+typedef struct {
+	uint8_t *data;
+	size_t   size, alloc;
+	int      failed;
+} buffer_t;
+
+// ------------------------------------------------------------------------------------------------
+// Standard (zlib) CRC-32, used to check the source, target and patch of a BPS file.
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size) {
+	static uint32_t table[256];
+	
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = i;
+			for (int j = 0; j < 8; j++)
+				value = (value >> 1) ^ (value & 1 ? 0xEDB88320 : 0);
+			table[i] = value;
+		}
+	}
+	
+	crc = ~crc;
+	while (size--)
+		crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void buffer_add(buffer_t *this, const void *data, size_t size) {
+	if (this->size + size > this->alloc) {
+		size_t   alloc = this->alloc ? this->alloc : 4096;
+		uint8_t *newdata;
+		
+		while (this->size + size > alloc) alloc *= 2;
+		if (!(newdata = realloc(this->data, alloc))) {
+			this->failed = 1;
+			return;
+		}
+		this->data  = newdata;
+		this->alloc = alloc;
+	}
+	
+	memcpy(this->data + this->size, data, size);
+	this->size += size;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void buffer_byte(buffer_t *this, uint8_t value) {
+	buffer_add(this, &value, 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Adds a number in BPS's variable-length format.
+static void buffer_number(buffer_t *this, uint64_t value) {
+	while (1) {
+		uint8_t bits = value & 0x7F;
+		value >>= 7;
+		if (!value) {
+			buffer_byte(this, 0x80 | bits);
+			break;
+		}
+		buffer_byte(this, bits);
+		value--;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads a number in BPS's variable-length format.
+// Returns 0 if the end of the data was reached first.
+static int read_number(const uint8_t **data, const uint8_t *end, uint64_t *value) {
+	uint64_t shift = 1;
+	
+	*value = 0;
+	while (*data < end && shift) {
+		uint8_t bits = *(*data)++;
+		*value += (bits & 0x7F) * shift;
+		if (bits & 0x80) return 1;
+		shift <<= 7;
+		*value += shift;
+	}
+	
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static int record_compare(const void *a, const void *b) {
+	const patch_record_t *ra = (const patch_record_t*)a, *rb = (const patch_record_t*)b;
+	
+	if (ra->offset != rb->offset) return ra->offset < rb->offset ? -1 : 1;
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Adds data to be written to a ROM.
+// Returns 0 on failure.
+int patch_add(patch_t *this, size_t offset, const uint8_t *data, size_t size) {
+	patch_record_t *record;
+	
+	if (!size) return 1;
+	if (this->count == this->alloc) {
+		size_t alloc = this->alloc ? 2 * this->alloc : 64;
+		patch_record_t *records = realloc(this->records, alloc * sizeof(patch_record_t));
+		if (!records) return 0;
+		this->records = records;
+		this->alloc   = alloc;
+	}
+	
+	record = &this->records[this->count];
+	if (!(record->data = malloc(size))) return 0;
+	memcpy(record->data, data, size);
+	record->offset = offset;
+	record->size   = size;
+	this->count++;
+	
+	return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+void patch_free(patch_t *this) {
+	for (size_t i = 0; i < this->count; i++)
+		free(this->records[i].data);
+	free(this->records);
+	
+	this->records = NULL;
+	this->count = this->alloc = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Builds an IPS patch. The ROM is only needed to fill in the byte before any record which would
+// start at offset 0x454F46 (since "EOF" marks the end of the file).
+static const char* patch_ips(const patch_t *this, const rom_t *rom, buffer_t *out) {
+	size_t end = 0;
+	
+	buffer_add(out, "PATCH", 5);
+	
+	for (size_t i = 0; i < this->count; i++) {
+		const patch_record_t *record = &this->records[i];
+		
+		if (record->offset + record->size > IPS_MAX_SIZE)
+			return "IPS patches can't change anything past 16 MB";
+		
+		for (size_t pos = 0; pos < record->size;) {
+			size_t  offset = record->offset + pos;
+			size_t  size = record->size - pos;
+			uint8_t prev = 0;
+			int     extra = 0;
+			
+			if (offset == IPS_EOF) {
+				// start one byte earlier, rewriting whatever that byte will be anyway
+				if (pos) prev = record->data[pos - 1];
+				else if (end == offset && i) prev = this->records[i - 1].data[this->records[i - 1].size - 1];
+				else if (offset - 1 < rom->size) prev = rom->data[offset - 1];
+				offset--;
+				extra = 1;
+			}
+			if (size + extra > IPS_MAX_CHUNK) size = IPS_MAX_CHUNK - extra;
+			
+			buffer_byte(out, offset >> 16);
+			buffer_byte(out, offset >> 8);
+			buffer_byte(out, offset);
+			buffer_byte(out, (size + extra) >> 8);
+			buffer_byte(out, size + extra);
+			if (extra) buffer_byte(out, prev);
+			buffer_add(out, record->data + pos, size);
+			
+			pos += size;
+		}
+		end = record->offset + record->size;
+	}
+	
+	buffer_add(out, "EOF", 3);
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Builds a BPS patch, which reads everything that hasn't changed from the original ROM.
+// Anything between the end of the original ROM and new data past it is filled with zeros
+// (the same as inserting the data directly would do).
+static const char* patch_bps(const patch_t *this, const rom_t *rom, buffer_t *out) {
+	size_t   targetsize = rom->size, pos = 0, targetpos = 0;
+	uint32_t crc = 0;
+	uint8_t  zero[256] = {0};
+	
+	if (this->count) {
+		const patch_record_t *last = &this->records[this->count - 1];
+		if (last->offset + last->size > targetsize) targetsize = last->offset + last->size;
+	}
+	
+	buffer_add(out, "BPS1", 4);
+	buffer_number(out, rom->size);
+	buffer_number(out, targetsize);
+	buffer_number(out, 0);
+	
+	for (size_t i = 0; i <= this->count; i++) {
+		size_t next = i < this->count ? this->records[i].offset : targetsize;
+		
+		// unchanged data from the original ROM
+		if (pos < next && pos < rom->size) {
+			size_t size = (next < rom->size ? next : rom->size) - pos;
+			
+			buffer_number(out, ((uint64_t)(size - 1) << 2) | BPS_SOURCE_READ);
+			crc = crc32_update(crc, rom->data + pos, size);
+			pos += size;
+		}
+		// empty space past the end of the original ROM
+		// (a single zero, then a copy of it repeated to fill the rest of the space)
+		if (pos < next) {
+			buffer_number(out, BPS_TARGET_READ);
+			buffer_byte(out, 0);
+			if (next - pos > 1) {
+				buffer_number(out, ((uint64_t)(next - pos - 2) << 2) | BPS_TARGET_COPY);
+				buffer_number(out, pos >= targetpos ? (uint64_t)(pos - targetpos) << 1
+				                                    : ((uint64_t)(targetpos - pos) << 1) | 1);
+				targetpos = next - 1;
+			}
+			for (; pos < next; pos += sizeof(zero)) {
+				size_t size = next - pos < sizeof(zero) ? next - pos : sizeof(zero);
+				crc = crc32_update(crc, zero, size);
+			}
+			pos = next;
+		}
+		
+		if (i < this->count && this->records[i].size) {
+			const patch_record_t *record = &this->records[i];
+			
+			buffer_number(out, ((uint64_t)(record->size - 1) << 2) | BPS_TARGET_READ);
+			buffer_add(out, record->data, record->size);
+			crc = crc32_update(crc, record->data, record->size);
+			pos += record->size;
+		}
+	}
+	
+	uint32_t crcs[2] = {crc32_update(0, rom->data, rom->size), crc};
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 4; j++)
+			buffer_byte(out, crcs[i] >> (8 * j));
+	}
+	if (!out->failed) {
+		crc = crc32_update(0, out->data, out->size);
+		for (int j = 0; j < 4; j++)
+			buffer_byte(out, crc >> (8 * j));
+	}
+	
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writes a patch which makes the same changes to a ROM that inserting the data directly would.
+// Returns NULL on success, or an error message.
+const char* patch_write(patch_t *this, const rom_t *rom, const char *path, patch_format_e format) {
+	buffer_t    out = {0};
+	const char *error;
+	FILE       *file;
+	
+	qsort(this->records, this->count, sizeof(patch_record_t), record_compare);
+	for (size_t i = 1; i < this->count; i++) {
+		if (this->records[i - 1].offset + this->records[i - 1].size > this->records[i].offset)
+			return "patch contains overlapping data";
+	}
+	
+	if (format == PATCH_BPS)
+		error = patch_bps(this, rom, &out);
+	else
+		error = patch_ips(this, rom, &out);
+	
+	if (!error && out.failed) {
+		error = "out of memory";
+	} else if (!error) {
+		if (!(file = fopen(path, "wb"))) {
+			error = "unable to open patch file";
+		} else {
+			if (fwrite(out.data, 1, out.size, file) != out.size)
+				error = "unable to write patch file";
+			if (fclose(file) && !error)
+				error = "unable to write patch file";
+		}
+	}
+	
+	free(out.data);
+	return error;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads every record in an IPS patch, and also writes each one to the ROM if run is non-NULL
+// (a buffer used for run-length encoded records).
+// Returns NULL if the entire patch is valid, or an error message.
+static const char* ips_records(rom_t *rom, const uint8_t *data, size_t size, uint8_t *run) {
+	const uint8_t *end = data + size;
+	const char *error = "patch is incomplete";
+	// size of the ROM once every record is written
+	size_t romsize = rom->size;
+	
+	data += 5;
+	while (end - data >= 3) {
+		size_t offset = (data[0] << 16) | (data[1] << 8) | data[2];
+		
+		data += 3;
+		if (offset == IPS_EOF) {
+			// a size after the end marker truncates the ROM, which isn't supported
+			if (end - data >= 3 && (size_t)((data[0] << 16) | (data[1] << 8) | data[2]) < romsize)
+				error = "patch would make the ROM smaller";
+			else
+				error = NULL;
+			break;
+		}
+		if (end - data < 2) break;
+		size_t length = (data[0] << 8) | data[1];
+		data += 2;
+		
+		if (length) {
+			if ((size_t)(end - data) < length) break;
+			if (run && !rom_write(rom, offset, data, length)) {
+				error = "unable to write to ROM";
+				break;
+			}
+			data += length;
+		} else {
+			// run-length encoded record
+			if (end - data < 3) break;
+			length = (data[0] << 8) | data[1];
+			if (run) {
+				memset(run, data[2], length);
+				if (!rom_write(rom, offset, run, length)) {
+					error = "unable to write to ROM";
+					break;
+				}
+			}
+			data += 3;
+		}
+		if (offset + length > romsize) romsize = offset + length;
+	}
+	
+	return error;
+}
+
+// ------------------------------------------------------------------------------------------------
+static const char* patch_apply_ips(rom_t *rom, const uint8_t *data, size_t size) {
+	const char *error;
+	uint8_t *run;
+	
+	// check the entire patch first, so that the ROM is left alone if any of it is invalid
+	if ((error = ips_records(rom, data, size, NULL)))
+		return error;
+	if (!(run = malloc(IPS_MAX_CHUNK)))
+		return "out of memory";
+	
+	error = ips_records(rom, data, size, run);
+	free(run);
+	return error;
+}
+
+// ------------------------------------------------------------------------------------------------
+static const char* patch_apply_bps(rom_t *rom, const uint8_t *data, size_t size) {
+	const uint8_t *start = data, *end = data + size - 12;
+	uint64_t sourcesize, targetsize, metasize;
+	uint64_t outpos = 0, sourcepos = 0, targetpos = 0;
+	uint8_t *target;
+	const char *error = NULL;
+	uint32_t crcs[3];
+	
+	if (size < 4 + 3 + 12) return "patch is incomplete";
+	for (int i = 0; i < 3; i++) {
+		const uint8_t *crc = end + 4 * i;
+		crcs[i] = crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((uint32_t)crc[3] << 24);
+	}
+	if (crc32_update(0, start, size - 4) != crcs[2])
+		return "patch is damaged";
+	
+	data += 4;
+	if (!read_number(&data, end, &sourcesize) || !read_number(&data, end, &targetsize)
+	    || !read_number(&data, end, &metasize) || metasize > (uint64_t)(end - data))
+		return "patch is damaged";
+	data += metasize;
+	
+	if (sourcesize != rom->size || crc32_update(0, rom->data, rom->size) != crcs[0])
+		return "patch is for a different ROM";
+	if (targetsize < rom->size)
+		return "patch would make the ROM smaller";
+	if (!(target = malloc(targetsize ? targetsize : 1)))
+		return "out of memory";
+	
+	while (data < end && !error) {
+		uint64_t command, offset, length;
+		
+		if (!read_number(&data, end, &command)) {
+			error = "patch is damaged";
+			break;
+		}
+		length = (command >> 2) + 1;
+		if (length > targetsize - outpos) {
+			error = "patch is damaged";
+			break;
+		}
+		
+		switch (command & 3) {
+		case BPS_SOURCE_READ:
+			if (outpos + length > sourcesize) error = "patch is damaged";
+			else memcpy(target + outpos, rom->data + outpos, length);
+			break;
+		
+		case BPS_TARGET_READ:
+			if (length > (uint64_t)(end - data)) {
+				error = "patch is damaged";
+			} else {
+				memcpy(target + outpos, data, length);
+				data += length;
+			}
+			break;
+		
+		case BPS_SOURCE_COPY:
+		case BPS_TARGET_COPY:
+			if (!read_number(&data, end, &offset)) {
+				error = "patch is damaged";
+				break;
+			}
+			
+			uint64_t *pos = (command & 3) == BPS_SOURCE_COPY ? &sourcepos : &targetpos;
+			*pos += (offset & 1) ? -(offset >> 1) : (offset >> 1);
+			
+			if ((command & 3) == BPS_SOURCE_COPY) {
+				if (*pos > sourcesize || length > sourcesize - *pos) error = "patch is damaged";
+				else memcpy(target + outpos, rom->data + *pos, length);
+			} else {
+				// the source and destination can overlap (to repeat data)
+				if (*pos >= outpos) error = "patch is damaged";
+				else for (uint64_t i = 0; i < length; i++) target[outpos + i] = target[*pos + i];
+			}
+			*pos += length;
+			break;
+		}
+		outpos += length;
+	}
+	
+	if (!error && (outpos != targetsize || crc32_update(0, target, targetsize) != crcs[1]))
+		error = "patch is damaged";
+	if (!error && !rom_write(rom, 0, target, targetsize))
+		error = "unable to write to ROM";
+	
+	free(target);
+	return error;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Applies an IPS or BPS patch to a writable ROM.
+// Returns NULL on success, or an error message.
+const char* patch_apply(rom_t *rom, const uint8_t *data, size_t size) {
+	if (size >= 5 && !memcmp(data, "PATCH", 5))
+		return patch_apply_ips(rom, data, size);
+	if (size >= 4 && !memcmp(data, "BPS1", 4))
+		return patch_apply_bps(rom, data, size);
+	
+	return "not an IPS or BPS patch";
+}
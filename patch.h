@@ -0,0 +1,64 @@
+/*
+	exhal / inhal IPS and BPS patches
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _PATCH_H
+#define _PATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rom.h"
+
+typedef enum {
+	PATCH_IPS = 0,
+	PATCH_BPS = 1,
+} patch_format_e;
+
+// data to be written to a ROM
+typedef struct {
+	size_t   offset, size;
+	uint8_t *data;
+} patch_record_t;
+
+// a list of changes to a ROM (in any order, but not overlapping each other)
+typedef struct {
+	patch_record_t *records;
+	size_t count, alloc;
+} patch_t;
+
+int         patch_add(patch_t *patch, size_t offset, const uint8_t *data, size_t size);
+void        patch_free(patch_t *patch);
+const char* patch_write(patch_t *patch, const rom_t *rom, const char *path, patch_format_e format);
+const char* patch_apply(rom_t *rom, const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
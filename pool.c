@@ -0,0 +1,203 @@
+/*
+	exhal / inhal thread pool
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// max number of threads used by pool_run
+#define MAX_THREADS 256
+
+// range of items which hasn't been worked on yet by a single thread
+typedef struct {
+	pthread_mutex_t lock;
+	size_t next, end;
+} pool_range_t;
+
+typedef struct {
+	pool_range_t ranges[MAX_THREADS];
+	int threads;
+	size_t grain;
+	
+	pool_func_t func;
+	void *arg;
+} pool_t;
+
+// passed to each worker thread
+typedef struct {
+	pool_t *pool;
+	int thread;
+} pool_worker_t;
+
+// ------------------------------------------------------------------------------------------------
+// Returns the number of threads to use by default (i.e. the number of CPUs available).
+int pool_default_threads(void) {
+	int cpus;
+
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	cpus = (int)info.dwNumberOfProcessors;
+#else
+	cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	if (cpus < 1) return 1;
+	if (cpus > MAX_THREADS) return MAX_THREADS;
+	return cpus;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Takes up to one grain's worth of items from the start of a range.
+// Returns 0 if there was nothing left to take.
+static int pool_take(pool_t *this, pool_range_t *range, size_t *start, size_t *end) {
+	int taken = 0;
+	
+	pthread_mutex_lock(&range->lock);
+	if (range->next < range->end) {
+		*start = range->next;
+		*end   = range->end - range->next > this->grain ? range->next + this->grain : range->end;
+		range->next = *end;
+		taken = 1;
+	}
+	pthread_mutex_unlock(&range->lock);
+	
+	return taken;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Steals the second half of the remaining items from another thread's range.
+// Returns 0 if no other thread had anything left worth stealing.
+static int pool_steal(pool_t *this, int thread) {
+	pool_range_t *own = &this->ranges[thread];
+	
+	for (int i = 1; i < this->threads; i++) {
+		pool_range_t *victim = &this->ranges[(thread + i) % this->threads];
+		size_t start = 0, end = 0;
+		
+		pthread_mutex_lock(&victim->lock);
+		if (victim->end - victim->next > this->grain) {
+			start = victim->next + (victim->end - victim->next) / 2;
+			end   = victim->end;
+			victim->end = start;
+		} else if (victim->next < victim->end) {
+			// only one grain left, just take all of it
+			start = victim->next;
+			end   = victim->end;
+			victim->next = end;
+		}
+		pthread_mutex_unlock(&victim->lock);
+		
+		if (start < end) {
+			pthread_mutex_lock(&own->lock);
+			own->next = start;
+			own->end  = end;
+			pthread_mutex_unlock(&own->lock);
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void* pool_worker(void *arg) {
+	pool_worker_t *worker = (pool_worker_t*)arg;
+	pool_t *this = worker->pool;
+	size_t start, end;
+	
+	do {
+		while (pool_take(this, &this->ranges[worker->thread], &start, &end))
+			this->func(this->arg, start, end, worker->thread);
+	} while (pool_steal(this, worker->thread));
+	
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Calls func for every item from 0 to count-1, spread across a number of threads.
+// Each thread starts with an equal share of the items, and works through them in ranges of up to
+// grain items at a time; once a thread runs out of work, it takes half of another thread's
+// remaining items. Returns once all items are done.
+void pool_run(size_t count, size_t grain, int threads, pool_func_t func, void *arg) {
+	pool_t *this;
+	pthread_t     handles[MAX_THREADS];
+	pool_worker_t workers[MAX_THREADS];
+	
+	if (!count) return;
+	if (!grain) grain = 1;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	if ((size_t)threads > (count + grain - 1) / grain)
+		threads = (int)((count + grain - 1) / grain);
+	
+	// don't bother with any extra threads if there's only one
+	if (threads <= 1 || !(this = calloc(1, sizeof(*this)))) {
+		for (size_t i = 0; i < count; i += grain)
+			func(arg, i, count - i > grain ? i + grain : count, 0);
+		return;
+	}
+	
+	this->threads = threads;
+	this->grain   = grain;
+	this->func    = func;
+	this->arg     = arg;
+	
+	for (int i = 0; i < threads; i++) {
+		pthread_mutex_init(&this->ranges[i].lock, NULL);
+		this->ranges[i].next = count * i / threads;
+		this->ranges[i].end  = count * (i + 1) / threads;
+	}
+	
+	// the calling thread does its share of the work too
+	for (int i = 0; i < threads; i++) {
+		workers[i].pool   = this;
+		workers[i].thread = i;
+		
+		if (i && pthread_create(&handles[i], NULL, pool_worker, &workers[i])) {
+			// couldn't start this thread, let the others steal its work
+			workers[i].pool = NULL;
+		}
+	}
+	pool_worker(&workers[0]);
+	
+	for (int i = 1; i < threads; i++) {
+		if (workers[i].pool)
+			pthread_join(handles[i], NULL);
+	}
+	// in case any threads failed to start, make sure everything was done
+	pool_worker(&workers[0]);
+	
+	for (int i = 0; i < threads; i++)
+		pthread_mutex_destroy(&this->ranges[i].lock);
+	free(this);
+}
@@ -0,0 +1,48 @@
+/*
+	exhal / inhal thread pool
+
+	Copyright (c) 2013-2018 Devin Acker
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+// Called by pool_run for each range of items [start, end).
+// thread is the index (from 0 to threads-1) of the thread doing the work, which can be used
+// to keep separate buffers/results for each thread.
+typedef void (*pool_func_t)(void *arg, size_t start, size_t end, int thread);
+
+int  pool_default_threads(void);
+void pool_run(size_t count, size_t grain, int threads, pool_func_t func, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
@@ -0,0 +1,374 @@
+/*
+	exhal / inhal code reference search
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "refs.h"
+
+// number of bytes before each call to look through for the address of the data
+#define REFS_WINDOW 32
+// max number of values of each kind to take from the code before a call
+#define REFS_VALUES 8
+// max number of entries to read from a pointer table
+#define REFS_TABLE 256
+
+const char *map_names[MAP_COUNT] = {"lorom", "hirom", "gb"};
+
+// 24-bit addresses of decompression routines (both JSR and JSL entry points) from gamenotes.txt
+const uint32_t known_routines[] = {
+	0x8087CA, 0x8087C6, // Alcahest
+	0x008766, 0x808762, // Arcana
+	0xC41A9E, 0xC419EA, // EarthBound
+	0x0089AA, 0x0089A6, // Hole in One Golf
+	0x0089E6, 0x0089E2, // HyperZone
+	0x01DD8A, 0x01DEAA, // Bass Tsuri No. 1
+	0x8089DF, 0x8089DB, // Kirby no KiraKira Kids
+	0x00889A,           // Kirby Super Star
+	0x809F18, 0x809F1A, // Kirby's Dream Course
+	0x00AA55, 0x00AA63, // Kirby's Dream Land 3
+	0x00CC48,           // Othello World
+	0x00983B,           // Okamoto Ayako to Match Play Golf
+	0x0090DD, 0x0090D3, 0x0090A6, // SimCity
+	0xC10000,           // SimCity 2000
+	0x838E13,           // Special Tee Shot
+	0x0088A2, 0x00889E, // Super Famicom Box BIOS
+	0x0087DB, 0x0087D7, 0x0087F6, 0x0087F2, // Vegas Stakes
+};
+const size_t num_known_routines = sizeof(known_routines) / sizeof(known_routines[0]);
+
+typedef struct {
+	const rom_t *rom;
+	map_e  map;
+	// size of a copier header at the start of the file (if any)
+	size_t header;
+	
+	ref_t  *refs;
+	size_t count, alloc;
+} refs_t;
+
+// ------------------------------------------------------------------------------------------------
+// Converts a CPU address to a file offset.
+// Returns -1 if the address isn't in ROM.
+static long map_offset(const refs_t *this, uint32_t address) {
+	unsigned bank = (address >> 16) & 0xFF;
+	unsigned addr = address & 0xFFFF;
+	size_t offset;
+	
+	switch (this->map) {
+	case MAP_LOROM:
+		if (addr < 0x8000 || bank == 0x7E || bank == 0x7F) return -1;
+		offset = ((bank & 0x7F) << 15) | (addr & 0x7FFF);
+		break;
+	
+	case MAP_HIROM:
+		if (bank == 0x7E || bank == 0x7F) return -1;
+		if ((bank & 0x40) == 0 && addr < 0x8000) return -1;
+		offset = ((bank & 0x3F) << 16) | addr;
+		break;
+	
+	case MAP_GB:
+		if (addr >= 0x8000) return -1;
+		if (addr < 0x4000) {
+			offset = addr;
+		} else {
+			// bank 0 can't be switched in here, so MBCs use bank 1 instead
+			offset = ((bank ? bank : 1) << 14) | (addr & 0x3FFF);
+		}
+		break;
+	
+	default:
+		return -1;
+	}
+	
+	offset += this->header;
+	return offset < this->rom->size ? (long)offset : -1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the bank that code at a file offset runs from.
+static unsigned map_bank(const refs_t *this, size_t offset) {
+	offset -= this->header;
+	
+	switch (this->map) {
+	case MAP_LOROM: return (offset >> 15) & 0x7F;
+	case MAP_HIROM: return 0xC0 | ((offset >> 16) & 0x3F);
+	default:        return (offset >> 14) & 0xFF;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Guesses which memory map a ROM uses from its header.
+map_e refs_detect_map(const rom_t *rom) {
+	static const uint8_t gblogo[] = {0xCE, 0xED, 0x66, 0x66};
+	
+	if (rom->size >= 0x150 && !memcmp(rom->data + 0x104, gblogo, sizeof(gblogo)))
+		return MAP_GB;
+	
+	size_t header = (rom->size & 0x7FFF) == 0x200 ? 0x200 : 0;
+	int    score[2] = {0};
+	
+	for (int map = MAP_LOROM; map <= MAP_HIROM; map++) {
+		size_t base = header + (map == MAP_HIROM ? 0xFFC0 : 0x7FC0);
+		if (base + 0x20 > rom->size) continue;
+		
+		const uint8_t *snes = rom->data + base;
+		unsigned complement = snes[0x1C] | (snes[0x1D] << 8);
+		unsigned checksum   = snes[0x1E] | (snes[0x1F] << 8);
+		
+		if ((complement ^ checksum) == 0xFFFF) score[map] += 2;
+		// map mode byte should agree with the header's location
+		if ((snes[0x15] & 0xE0) == 0x20 && (snes[0x15] & 1) == map) score[map]++;
+	}
+	
+	return score[MAP_HIROM] > score[MAP_LOROM] ? MAP_HIROM : MAP_LOROM;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void refs_add(refs_t *this, long offset, size_t source) {
+	if (offset < 0) return;
+	
+	if (this->count == this->alloc) {
+		this->alloc = this->alloc ? 2 * this->alloc : 64;
+		this->refs = realloc(this->refs, this->alloc * sizeof(ref_t));
+		if (!this->refs) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+	}
+	this->refs[this->count].offset = (uint32_t)offset;
+	this->refs[this->count].source = (uint32_t)source;
+	this->count++;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void refs_add_value(unsigned *values, int *count, unsigned value) {
+	for (int i = 0; i < *count; i++)
+		if (values[i] == value) return;
+	
+	if (*count < REFS_VALUES) values[(*count)++] = value;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Adds every valid pointer from a table of 24-bit addresses.
+static void refs_add_table(refs_t *this, long table, size_t source) {
+	if (table < 0) return;
+	
+	for (size_t i = 0; i < REFS_TABLE && table + 3 * (i + 1) <= this->rom->size; i++) {
+		const uint8_t *entry = this->rom->data + table + 3 * i;
+		long offset = map_offset(this, entry[0] | (entry[1] << 8) | (entry[2] << 16));
+		// the end of the table is (probably) wherever it stops pointing to ROM
+		if (offset < 0) break;
+		
+		refs_add(this, offset, source);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Looks at the code before a 65816 call to a decompression routine for the address of the data
+// being passed to it, either as immediate values or as an indexed load from a pointer table.
+// Since the code before the call can't be disassembled reliably, every byte is treated as a
+// possible opcode.
+static void refs_snes_args(refs_t *this, size_t call) {
+	const uint8_t *data = this->rom->data;
+	size_t   start = call > REFS_WINDOW ? call - REFS_WINDOW : 0;
+	unsigned bank  = map_bank(this, call);
+	
+	unsigned words[REFS_VALUES], banks[REFS_VALUES];
+	int numwords = 0, numbanks = 0;
+	
+	refs_add_value(banks, &numbanks, bank);
+	
+	for (size_t i = start; i + 2 < call; i++) {
+		unsigned word = data[i + 1] | (data[i + 2] << 8);
+		
+		switch (data[i]) {
+		case 0xA9: // LDA #imm
+		case 0xA2: // LDX #imm
+		case 0xA0: // LDY #imm
+			// register size isn't known, so this might be an 8-bit bank or a 16-bit address
+			refs_add_value(banks, &numbanks, data[i + 1]);
+			// fall through
+		case 0xF4: // PEA addr
+			refs_add_value(words, &numwords, word);
+			break;
+		
+		case 0xBD: // LDA abs,X
+		case 0xB9: // LDA abs,Y
+		case 0xBC: // LDY abs,X
+		case 0xBE: // LDX abs,Y
+			refs_add_table(this, map_offset(this, (bank << 16) | word), call);
+			break;
+		
+		case 0xBF: // LDA long,X
+			if (i + 3 < call)
+				refs_add_table(this, map_offset(this, (data[i + 3] << 16) | word), call);
+			break;
+		}
+	}
+	
+	for (int w = 0; w < numwords; w++)
+		for (int b = 0; b < numbanks; b++)
+			refs_add(this, map_offset(this, (banks[b] << 16) | words[w]), call);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Same as above, for GB (LR35902) code.
+static void refs_gb_args(refs_t *this, size_t call) {
+	const uint8_t *data = this->rom->data;
+	size_t   start = call > REFS_WINDOW ? call - REFS_WINDOW : 0;
+	unsigned bank  = map_bank(this, call);
+	
+	unsigned words[REFS_VALUES], banks[REFS_VALUES];
+	int numwords = 0, numbanks = 0;
+	
+	if (bank) refs_add_value(banks, &numbanks, bank);
+	
+	for (size_t i = start; i + 1 < call; i++) {
+		switch (data[i]) {
+		case 0x3E: // LD A, n
+			refs_add_value(banks, &numbanks, data[i + 1]);
+			break;
+		
+		case 0x01: // LD BC, nn
+		case 0x11: // LD DE, nn
+		case 0x21: // LD HL, nn
+			if (i + 2 < call)
+				refs_add_value(words, &numwords, data[i + 1] | (data[i + 2] << 8));
+			break;
+		}
+	}
+	
+	for (int w = 0; w < numwords; w++) {
+		if (words[w] < 0x4000) {
+			refs_add(this, map_offset(this, words[w]), call);
+		} else {
+			for (int b = 0; b < numbanks; b++)
+				refs_add(this, map_offset(this, (banks[b] << 16) | words[w]), call);
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks whether a call from one offset to an address goes to any of the routines.
+static int refs_is_routine(const refs_t *this, size_t call, uint32_t address,
+                           const uint32_t *routines, size_t numroutines) {
+	if (this->map == MAP_GB) {
+		unsigned bank = map_bank(this, call);
+		
+		for (size_t i = 0; i < numroutines; i++) {
+			if ((routines[i] & 0xFFFF) != address) continue;
+			// calls into the switchable bank only count if it's (possibly) the right one
+			if (address < 0x4000 || !bank || !(routines[i] >> 16) || (routines[i] >> 16) == bank)
+				return 1;
+		}
+		return 0;
+	}
+	
+	// compare the actual locations in ROM, since the same code can be called from mirrored banks
+	long offset = map_offset(this, address);
+	if (offset < 0) return 0;
+	
+	for (size_t i = 0; i < numroutines; i++)
+		if (map_offset(this, routines[i]) == offset) return 1;
+	
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static int refs_compare(const void *a, const void *b) {
+	const ref_t *ra = (const ref_t*)a, *rb = (const ref_t*)b;
+	
+	if (ra->offset != rb->offset) return ra->offset < rb->offset ? -1 : 1;
+	if (ra->source != rb->source) return ra->source < rb->source ? -1 : 1;
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Finds every call (or jump) to the given decompression routines, and the possible locations
+// of compressed data passed to them.
+// Returns the number of locations found; *refs is set to a list of them (sorted by offset, with
+// each offset only listed once) which should be freed by the caller.
+size_t refs_find(const rom_t *rom, map_e map, const uint32_t *routines, size_t numroutines,
+                 ref_t **refs) {
+	refs_t this = {0};
+	this.rom = rom;
+	this.map = map;
+	if (map != MAP_GB && (rom->size & 0x7FFF) == 0x200)
+		this.header = 0x200;
+	
+	const uint8_t *data = rom->data;
+	
+	for (size_t i = this.header; i + 3 < rom->size; i++) {
+		unsigned word = data[i + 1] | (data[i + 2] << 8);
+		uint32_t target;
+		
+		if (map == MAP_GB) {
+			switch (data[i]) {
+			case 0xCD: // CALL nn
+			case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL cc, nn
+			case 0xC3: // JP nn
+				target = word;
+				break;
+			default:
+				continue;
+			}
+			
+			if (refs_is_routine(&this, i, target, routines, numroutines))
+				refs_gb_args(&this, i);
+		
+		} else {
+			switch (data[i]) {
+			case 0x20: // JSR addr
+			case 0x4C: // JMP addr
+				target = (map_bank(&this, i) << 16) | word;
+				break;
+			case 0x22: // JSL long
+			case 0x5C: // JML long
+				target = (data[i + 3] << 16) | word;
+				break;
+			default:
+				continue;
+			}
+			
+			if (refs_is_routine(&this, i, target, routines, numroutines))
+				refs_snes_args(&this, i);
+		}
+	}
+	
+	// sort everything and only keep the first reference to each offset
+	size_t count = 0;
+	if (this.count) {
+		qsort(this.refs, this.count, sizeof(ref_t), refs_compare);
+		
+		for (size_t i = 0; i < this.count; i++) {
+			if (!count || this.refs[count - 1].offset != this.refs[i].offset)
+				this.refs[count++] = this.refs[i];
+		}
+	}
+	
+	*refs = this.refs;
+	return count;
+}
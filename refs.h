@@ -0,0 +1,66 @@
+/*
+	exhal / inhal code reference search
+
+	Copyright (c) 2013-2018 Devin Acker
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _REFS_H
+#define _REFS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rom.h"
+
+// ROM memory maps (used to convert between CPU addresses and file offsets)
+typedef enum {
+	MAP_LOROM = 0,
+	MAP_HIROM = 1,
+	MAP_GB    = 2,
+
+	MAP_COUNT
+} map_e;
+
+// a possible location of compressed data, found from the code which decompresses it
+typedef struct {
+	// offset of the data, and of the call to the decompression routine that led to it
+	uint32_t offset, source;
+} ref_t;
+
+extern const char *map_names[MAP_COUNT];
+
+// decompression routine addresses for known games (from gamenotes.txt)
+extern const uint32_t known_routines[];
+extern const size_t   num_known_routines;
+
+map_e  refs_detect_map(const rom_t *rom);
+size_t refs_find(const rom_t *rom, map_e map, const uint32_t *routines, size_t numroutines, ref_t **refs);
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
@@ -0,0 +1,213 @@
+/*
+	exhal / inhal ROM file access
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#include "rom.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// Maps the current contents of the file into memory.
+// Returns 0 on failure.
+static int rom_map(rom_t *this) {
+	this->data = NULL;
+	// can't map an empty file, but there's nothing to read from it anyway
+	if (!this->size) return 1;
+
+#ifdef _WIN32
+	this->mapping = CreateFileMapping((HANDLE)this->file, NULL,
+	                                  this->writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	if (!this->mapping) return 0;
+	
+	this->data = MapViewOfFile((HANDLE)this->mapping,
+	                           this->writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, this->size);
+	if (!this->data) {
+		CloseHandle((HANDLE)this->mapping);
+		this->mapping = NULL;
+		return 0;
+	}
+#else
+	void *data = mmap(NULL, this->size, this->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+	                  MAP_SHARED, this->fd, 0);
+	if (data == MAP_FAILED) return 0;
+	
+	this->data = (uint8_t*)data;
+#endif
+
+	return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void rom_unmap(rom_t *this) {
+	if (!this->data) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(this->data);
+	CloseHandle((HANDLE)this->mapping);
+	this->mapping = NULL;
+#else
+	munmap(this->data, this->size);
+#endif
+
+	this->data = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Copies the last 64 kb of the file into the zero-padded tail buffer.
+static void rom_update_tail(rom_t *this) {
+	this->tailoffset = this->size > DATA_SIZE ? this->size - DATA_SIZE : 0;
+	
+	memset(this->tail, 0, 2 * DATA_SIZE);
+	if (this->size)
+		memcpy(this->tail, this->data + this->tailoffset, this->size - this->tailoffset);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Opens and maps a ROM file. If writable is non-zero, the file can be modified with rom_write.
+// Returns NULL if the file couldn't be opened.
+rom_t* rom_open(const char *path, int writable) {
+	rom_t *this;
+	
+	if (!(this = calloc(1, sizeof(*this)))) return NULL;
+	if (!(this->tail = malloc(2 * DATA_SIZE))) {
+		free(this);
+		return NULL;
+	}
+	this->writable = writable;
+
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	HANDLE file = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+	                          FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size)) {
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		goto fail;
+	}
+	this->file = file;
+	this->size = (size_t)size.QuadPart;
+#else
+	struct stat st;
+	this->fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (this->fd < 0) goto fail;
+	if (fstat(this->fd, &st)) {
+		close(this->fd);
+		goto fail;
+	}
+	this->size = (size_t)st.st_size;
+#endif
+
+	if (!rom_map(this)) {
+		this->size = 0;
+		rom_close(this);
+		return NULL;
+	}
+	rom_update_tail(this);
+	return this;
+
+fail:
+	free(this->tail);
+	free(this);
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Unmaps and closes a ROM file (writing back any changes).
+void rom_close(rom_t *this) {
+	if (!this) return;
+	
+	rom_unmap(this);
+#ifdef _WIN32
+	CloseHandle((HANDLE)this->file);
+#else
+	close(this->fd);
+#endif
+
+	free(this->tail);
+	free(this);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns a pointer to data at an offset in the ROM, suitable for exhal_unpack and friends.
+// At least 64 kb can always be read from it; anything past the end of the file is read as zeros.
+const uint8_t* rom_packed(const rom_t *this, size_t offset) {
+	if (offset >= this->tailoffset) {
+		if (offset > this->size) offset = this->size;
+		return this->tail + (offset - this->tailoffset);
+	}
+	
+	return this->data + offset;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writes data to a writable ROM, making the file larger if needed.
+// Returns 0 on failure.
+int rom_write(rom_t *this, size_t offset, const uint8_t *data, size_t size) {
+	if (!this->writable) return 0;
+	if (!size) return 1;
+	
+	if (offset + size > this->size) {
+		// remap the file at its new size
+		rom_unmap(this);
+
+#ifdef _WIN32
+		LARGE_INTEGER newsize;
+		newsize.QuadPart = (LONGLONG)(offset + size);
+		if (!SetFilePointerEx((HANDLE)this->file, newsize, NULL, FILE_BEGIN)
+		    || !SetEndOfFile((HANDLE)this->file)) {
+			rom_map(this);
+			return 0;
+		}
+#else
+		if (ftruncate(this->fd, (off_t)(offset + size))) {
+			rom_map(this);
+			return 0;
+		}
+#endif
+
+		this->size = offset + size;
+		if (!rom_map(this)) {
+			this->size = 0;
+			rom_update_tail(this);
+			return 0;
+		}
+	}
+	
+	memcpy(this->data + offset, data, size);
+	if (offset + size > this->tailoffset)
+		rom_update_tail(this);
+	
+	return 1;
+}
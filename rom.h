@@ -0,0 +1,65 @@
+/*
+	exhal / inhal ROM file access
+
+	Copyright (c) 2013-2018 Devin Acker
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _ROM_H
+#define _ROM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A ROM file mapped into memory
+typedef struct {
+	// contents and size of the file
+	uint8_t *data;
+	size_t   size;
+	int      writable;
+
+	// copy of the last 64 kb of the file followed by 64 kb of zeros, so that data can be
+	// decompressed directly from any offset (even ones near the end of the file)
+	uint8_t *tail;
+	size_t   tailoffset;
+
+#ifdef _WIN32
+	void *file, *mapping;
+#else
+	int fd;
+#endif
+} rom_t;
+
+rom_t*         rom_open (const char *path, int writable);
+void           rom_close(rom_t *rom);
+const uint8_t* rom_packed(const rom_t *rom, size_t offset);
+int            rom_write(rom_t *rom, size_t offset, const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
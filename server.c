@@ -0,0 +1,436 @@
+/*
+	exhal / inhal compression server
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "compress.h"
+#include "pool.h"
+#include "server.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+// number of requests per worker thread which can be waiting to be handled
+#define JOBS_PER_THREAD 4
+
+// a client connected to the server (or stdin/stdout)
+typedef struct {
+	FILE *in, *out;
+	// number of requests which haven't been responded to yet
+	int   pending;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} connection_t;
+
+// a request waiting to be handled
+typedef struct job_s {
+	connection_t    *conn;
+	server_request_t request;
+	struct job_s    *next;
+	// input data (zero-padded to 64 kb)
+	uint8_t data[DATA_SIZE];
+} job_t;
+
+typedef struct {
+	// requests waiting to be handled (first to last), and unused ones
+	job_t *first, *last, *unused;
+	int    done;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} server_t;
+
+// ------------------------------------------------------------------------------------------------
+// Makes a job available for another request.
+static void server_release(server_t *this, job_t *job) {
+	pthread_mutex_lock(&this->lock);
+	job->next = this->unused;
+	this->unused = job;
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->lock);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Sends a response to a client. Only one thread can write to a connection at a time.
+static void server_respond(connection_t *conn, const server_response_t *response, const void *data) {
+	uint8_t header[RESPONSE_SIZE];
+	
+	server_put_response(header, response);
+	
+	pthread_mutex_lock(&conn->lock);
+	// a client which has gone away is only noticed when reading its next request
+	if (fwrite(header, 1, RESPONSE_SIZE, conn->out) == RESPONSE_SIZE && response->size)
+		fwrite(data, 1, response->size, conn->out);
+	fflush(conn->out);
+	pthread_mutex_unlock(&conn->lock);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void server_error(connection_t *conn, const server_request_t *request, int status, const char *error) {
+	server_response_t response = {
+		.id     = request->id,
+		.op     = request->op,
+		.status = status,
+		.size   = strlen(error),
+	};
+	server_respond(conn, &response, error);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Handles one request. out is a 64 kb buffer and ctx is a compression context, both of which
+// belong to the worker thread handling the request.
+static void server_handle(job_t *job, exhal_context_t *ctx, uint8_t *out) {
+	const server_request_t *request = &job->request;
+	server_response_t response = {
+		.id = request->id,
+		.op = request->op,
+	};
+	unpack_stats_t stats;
+	
+	if (request->op == SERVER_PACK) {
+		pack_options_t options = {0};
+		
+		server_level_options(request->level ? request->level : 2, &options);
+		options.speedweight = request->speedweight;
+		options.platform    = request->platform;
+		
+		response.unpackedsize = request->size;
+		response.packedsize   = exhal_pack3(ctx, job->data, request->size, out, &options);
+		response.size         = response.packedsize;
+		if (!response.packedsize) {
+			server_error(job->conn, request, SERVER_FAILED, "compressed data would be larger than 64 kb");
+			return;
+		}
+	} else {
+		if (request->op == SERVER_UNPACK) {
+			// back references can read data that hasn't been written yet, which should always be zero
+			memset(out, 0, DATA_SIZE);
+			response.unpackedsize = exhal_unpack(job->data, out, &stats);
+			response.size = response.unpackedsize;
+		} else {
+			response.unpackedsize = exhal_validate(job->data, &stats);
+		}
+		
+		if (!response.unpackedsize || stats.inputsize > request->size) {
+			server_error(job->conn, request, SERVER_FAILED, "not valid compressed data");
+			return;
+		}
+		response.packedsize = stats.inputsize;
+	}
+	
+	server_respond(job->conn, &response, out);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Handles requests until the server is shut down.
+static void* server_worker(void *arg) {
+	server_t *this = (server_t*)arg;
+	exhal_context_t *ctx = exhal_context_alloc();
+	uint8_t *out = malloc(DATA_SIZE);
+	
+	if (!ctx || !out) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	pthread_mutex_lock(&this->lock);
+	while (1) {
+		while (!this->first && !this->done)
+			pthread_cond_wait(&this->cond, &this->lock);
+		if (!this->first) break;
+		
+		job_t *job = this->first;
+		if (!(this->first = job->next))
+			this->last = NULL;
+		pthread_mutex_unlock(&this->lock);
+		
+		connection_t *conn = job->conn;
+		server_handle(job, ctx, out);
+		
+		pthread_mutex_lock(&conn->lock);
+		conn->pending--;
+		pthread_cond_broadcast(&conn->cond);
+		pthread_mutex_unlock(&conn->lock);
+		
+		server_release(this, job);
+		pthread_mutex_lock(&this->lock);
+	}
+	pthread_mutex_unlock(&this->lock);
+	
+	exhal_context_free(ctx);
+	free(out);
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads requests from a client and passes them on to the worker threads, until the client
+// disconnects (or sends an invalid request). Requests are read as soon as they arrive, without
+// waiting for earlier ones to be handled, until every job is in use.
+static void server_read(server_t *this, connection_t *conn) {
+	uint8_t header[REQUEST_SIZE];
+	
+	while (fread(header, 1, REQUEST_SIZE, conn->in) == REQUEST_SIZE) {
+		server_request_t request;
+		job_t *job;
+		
+		server_get_request(header, &request);
+		if (request.size > DATA_SIZE) {
+			server_error(conn, &request, SERVER_INVALID, "request is larger than 64 kb");
+			break;
+		}
+		
+		pthread_mutex_lock(&this->lock);
+		while (!this->unused)
+			pthread_cond_wait(&this->cond, &this->lock);
+		job = this->unused;
+		this->unused = job->next;
+		pthread_mutex_unlock(&this->lock);
+		
+		job->conn    = conn;
+		job->request = request;
+		job->next    = NULL;
+		if (fread(job->data, 1, request.size, conn->in) != request.size) {
+			server_release(this, job);
+			break;
+		}
+		memset(job->data + request.size, 0, DATA_SIZE - request.size);
+		
+		if (request.op < SERVER_PACK || request.op > SERVER_VALIDATE
+		    || (request.op == SERVER_PACK && (request.level > 4 || request.platform >= PLATFORM_COUNT))) {
+			server_error(conn, &request, SERVER_INVALID, "invalid operation or options");
+			server_release(this, job);
+			continue;
+		}
+		
+		pthread_mutex_lock(&conn->lock);
+		conn->pending++;
+		pthread_mutex_unlock(&conn->lock);
+		
+		pthread_mutex_lock(&this->lock);
+		if (this->last)
+			this->last->next = job;
+		else
+			this->first = job;
+		this->last = job;
+		pthread_cond_broadcast(&this->cond);
+		pthread_mutex_unlock(&this->lock);
+	}
+	
+	// wait for any requests still being handled before the connection goes away
+	pthread_mutex_lock(&conn->lock);
+	while (conn->pending)
+		pthread_cond_wait(&conn->cond, &conn->lock);
+	pthread_mutex_unlock(&conn->lock);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns NULL on failure.
+static connection_t* connection_alloc(FILE *in, FILE *out) {
+	connection_t *conn = calloc(1, sizeof(*conn));
+	
+	if (conn) {
+		conn->in  = in;
+		conn->out = out;
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_cond_init(&conn->cond, NULL);
+	}
+	return conn;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void connection_free(connection_t *conn) {
+	pthread_mutex_destroy(&conn->lock);
+	pthread_cond_destroy(&conn->cond);
+	free(conn);
+}
+
+#ifndef _WIN32
+
+// passed to a thread which handles a client connected to a socket
+typedef struct {
+	server_t *server;
+	int       fd;
+} client_t;
+
+// ------------------------------------------------------------------------------------------------
+static void* server_client(void *arg) {
+	client_t *client = (client_t*)arg;
+	int fd = dup(client->fd);
+	FILE *in  = fdopen(client->fd, "rb");
+	FILE *out = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	connection_t *conn = in && out ? connection_alloc(in, out) : NULL;
+	
+	if (conn) {
+		server_read(client->server, conn);
+		connection_free(conn);
+	}
+	
+	if (in) fclose(in);
+	else close(client->fd);
+	if (out) fclose(out);
+	else if (fd >= 0) close(fd);
+	free(client);
+	return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Accepts clients on a Unix domain socket (forever), handling each one on its own thread.
+static void server_listen(server_t *this, const char *path) {
+	struct sockaddr_un addr = {0};
+	int sock;
+	
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path is too long\n");
+		exit(-1);
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	
+	// a client which disconnects while a response is being written shouldn't stop the server
+	signal(SIGPIPE, SIG_IGN);
+	
+	unlink(path);
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	    || bind(sock, (struct sockaddr*)&addr, sizeof(addr))
+	    || listen(sock, 16)) {
+		fprintf(stderr, "Error: unable to listen on %s\n", path);
+		exit(-1);
+	}
+	fprintf(stderr, "Listening on %s\n", path);
+	
+	while (1) {
+		client_t *client;
+		pthread_t thread;
+		int fd = accept(sock, NULL, NULL);
+		
+		if (fd < 0) continue;
+		if (!(client = malloc(sizeof(*client)))) {
+			close(fd);
+			continue;
+		}
+		client->server = this;
+		client->fd     = fd;
+		if (pthread_create(&thread, NULL, server_client, client)) {
+			close(fd);
+			free(client);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+}
+
+#endif
+
+int main (int argc, char **argv) {
+	const char *socketpath = NULL;
+	int threads = 0;
+	
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") && i < argc - 1) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-socket") && i < argc - 1) {
+			socketpath = argv[++i];
+		} else {
+			fprintf(stderr, "halserver - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n"
+			                "Usage:\n%s [-j threads] [-socket path]\n\n"
+			                "Handles compression requests from stdin (writing responses to stdout),\n"
+			                "or from clients connected to a Unix domain socket with -socket.\n"
+			                "See server.h for a description of the protocol.\n",
+			                argv[0]);
+			exit(-1);
+		}
+	}
+	
+	if (threads <= 0) threads = pool_default_threads();
+	
+	server_t server = {0};
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	job_t     *jobs    = malloc(threads * JOBS_PER_THREAD * sizeof(job_t));
+	
+	if (!workers || !jobs) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (int i = 0; i < threads * JOBS_PER_THREAD; i++) {
+		jobs[i].next  = server.unused;
+		server.unused = &jobs[i];
+	}
+	
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.cond, NULL);
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&workers[i], NULL, server_worker, &server)) {
+			fprintf(stderr, "Error: unable to start worker threads\n");
+			exit(-1);
+		}
+	}
+	
+	if (socketpath) {
+#ifdef _WIN32
+		fprintf(stderr, "Error: -socket is not supported on Windows\n");
+		exit(-1);
+#else
+		server_listen(&server, socketpath);
+#endif
+	} else {
+		connection_t *conn;
+
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		if (!(conn = connection_alloc(stdin, stdout))) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+		server_read(&server, conn);
+		connection_free(conn);
+	}
+	
+	pthread_mutex_lock(&server.lock);
+	server.done = 1;
+	pthread_cond_broadcast(&server.cond);
+	pthread_mutex_unlock(&server.lock);
+	for (int i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+	
+	pthread_mutex_destroy(&server.lock);
+	pthread_cond_destroy(&server.cond);
+	free(workers);
+	free(jobs);
+	return 0;
+}
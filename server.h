@@ -0,0 +1,157 @@
+/*
+	exhal / inhal compression server protocol
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "compress.h"
+
+// Every request and response starts with a fixed size header (all values are little-endian),
+// followed by "size" bytes of data (at most 64 kb).
+//
+// request:
+//   0  u32  id (returned with the response; responses can arrive in any order)
+//   4  u8   operation (server_op_e)
+//   5  u8   compression level (1-4, or 0 for the default)
+//   6  u8   platform (platform_e) used when optimizing for decompression time
+//   7  u8   reserved (0)
+//   8  u32  speed weight (see pack_options_t)
+//  12  u32  size
+//
+// response:
+//   0  u32  id
+//   4  u8   operation
+//   5  u8   status (server_status_e)
+//   6  u16  reserved (0)
+//   8  u32  size of the compressed data
+//  12  u32  size of the uncompressed data
+//  16  u32  size (the output of the operation, or an error message)
+
+#define REQUEST_SIZE  16
+#define RESPONSE_SIZE 20
+
+typedef enum {
+	// compress data; the response contains the compressed data
+	SERVER_PACK     = 1,
+	// decompress data; the response contains the decompressed data
+	SERVER_UNPACK   = 2,
+	// check that data can be decompressed; the response only contains its sizes
+	SERVER_VALIDATE = 3,
+} server_op_e;
+
+typedef enum {
+	SERVER_OK      = 0,
+	// the request was malformed (the server closes the connection if the size is invalid)
+	SERVER_INVALID = 1,
+	// the data couldn't be compressed or decompressed
+	SERVER_FAILED  = 2,
+} server_status_e;
+
+typedef struct {
+	uint32_t id;
+	uint8_t  op, level, platform;
+	uint32_t speedweight;
+	uint32_t size;
+} server_request_t;
+
+typedef struct {
+	uint32_t id;
+	uint8_t  op, status;
+	uint32_t packedsize, unpackedsize;
+	uint32_t size;
+} server_response_t;
+
+// ------------------------------------------------------------------------------------------------
+static inline void server_put32(uint8_t *out, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		out[i] = value >> (8 * i);
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline uint32_t server_get32(const uint8_t *in) {
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline void server_put_request(uint8_t *out, const server_request_t *request) {
+	server_put32(out, request->id);
+	out[4] = request->op;
+	out[5] = request->level;
+	out[6] = request->platform;
+	out[7] = 0;
+	server_put32(out + 8,  request->speedweight);
+	server_put32(out + 12, request->size);
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline void server_get_request(const uint8_t *in, server_request_t *request) {
+	request->id          = server_get32(in);
+	request->op          = in[4];
+	request->level       = in[5];
+	request->platform    = in[6];
+	request->speedweight = server_get32(in + 8);
+	request->size        = server_get32(in + 12);
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline void server_put_response(uint8_t *out, const server_response_t *response) {
+	server_put32(out, response->id);
+	out[4] = response->op;
+	out[5] = response->status;
+	out[6] = out[7] = 0;
+	server_put32(out + 8,  response->packedsize);
+	server_put32(out + 12, response->unpackedsize);
+	server_put32(out + 16, response->size);
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline void server_get_response(const uint8_t *in, server_response_t *response) {
+	response->id           = server_get32(in);
+	response->op           = in[4];
+	response->status       = in[5];
+	response->packedsize   = server_get32(in + 8);
+	response->unpackedsize = server_get32(in + 12);
+	response->size         = server_get32(in + 16);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Converts a compression level (same as inhal's -1 to -4 options) to a set of options.
+static inline void server_level_options(int level, pack_options_t *options) {
+	options->fast    = level == 1 || level == 3;
+	options->optimal = level >= 3;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+// end include guard
+#endif
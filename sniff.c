@@ -1,45 +1,1034 @@
+#define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "codec.h"
 #include "compress.h"
+#include "hash.h"
+#include "index.h"
+#include "pool.h"
+#include "refs.h"
+#include "rom.h"
+
+// number of offsets checked by a thread at once
+#define CHUNK_SIZE 4096
+// max number of ranges given with -dirty
+#define MAX_RANGES 256
+// number of offsets checked by a thread at once when scanning several ROMs
+// (each chunk gets its own pre-pass, including the 64 kb after it)
+#define FILE_CHUNK_SIZE (256 * 1024)
+
+// a range of offsets [start, end)
+typedef struct {
+	size_t start, end;
+} sniff_range_t;
+
+// pre-pass results for each codec which has a pre-pass, starting from some offset
+typedef struct {
+	scan_entry_t *table[CODEC_COUNT];
+	int allocated;
+} sniff_tables_t;
+
+typedef struct {
+	const rom_t   *rom;
+	// which codecs to look for (one bit for each)
+	unsigned codecs;
+	// skip over the data for each result (and possibly report the results inside it)
+	int skip, nested;
+	// minimum uncompressed size of each result
+	size_t minsize;
+	// stricter checks used when validating data (also includes min. ratio and max. compressed size)
+	unpack_options_t options;
+	// range of offsets to check [start, end)
+	size_t start, end;
+	// pre-pass results for the offsets from the start
+	sniff_tables_t tables;
+	// results from each chunk of offsets (kept separately so they can be output in order)
+	sniff_index_t *chunks;
+} sniff_t;
+
+// one of several ROMs being scanned together
+// (each one is only open while it's being hashed or scanned)
+typedef struct {
+	char    *path;
+	size_t   size;
+	rom_t   *rom;
+	uint64_t hash;
+	// index of the first file with the same contents (or this one's own index)
+	size_t   same;
+	// was the index loaded from the cache?
+	int      cached;
+	// number of jobs for this file which haven't finished yet
+	size_t   pending;
+	
+	sniff_t       sniff;
+	sniff_index_t index;
+} sniff_file_t;
+
+// results from one chunk of offsets in a file
+typedef struct {
+	sniff_file_t *file;
+	size_t start;
+	sniff_index_t results;
+} sniff_job_t;
+
+typedef struct {
+	sniff_file_t *files;
+	size_t numfiles, allocfiles;
+	sniff_job_t  *jobs;
+	size_t numjobs, allocjobs;
+	// pre-pass results for each thread's current chunk
+	sniff_tables_t *tables;
+	// used when opening and closing files during a scan
+	pthread_mutex_t lock;
+} sniff_collection_t;
+
+// ------------------------------------------------------------------------------------------------
+static void sniff_add(sniff_index_t *chunk, size_t offset, codec_e codec, size_t outputsize,
+                      const unpack_stats_t *stats) {
+	sniff_result_t result;
+	
+	result.offset     = offset;
+	result.codec      = codec;
+	result.inputsize  = stats->inputsize;
+	result.outputsize = outputsize;
+	for (int i = 0; i < 7; i++)
+		result.methoduse[i] = stats->methoduse[i];
+	
+	index_add(chunk, &result);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the settings which affect what results are found (for saving them to an index).
+static sniff_params_t sniff_params(const sniff_t *this) {
+	sniff_params_t params;
+	
+	params.strict   = this->options.strict;
+	params.minsize  = this->minsize;
+	params.maxinput = this->options.maxinput;
+	params.minratio = this->options.minratio;
+	params.codecs   = this->codecs;
+	return params;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks whether valid data of a given size is worth reporting.
+static inline int sniff_candidate(const sniff_t *this, size_t inputsize, size_t outputsize) {
+	return outputsize > inputsize
+		&& outputsize >= this->minsize
+		&& (!this->options.maxinput || inputsize <= this->options.maxinput)
+		&& outputsize >= this->options.minratio * inputsize;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns how far back a change in the ROM can affect results, based on which codecs are used.
+static size_t sniff_lookback(const sniff_t *this) {
+	size_t lookback = 0;
+	
+	for (int c = 0; c < CODEC_COUNT; c++) {
+		if ((this->codecs & (1 << c)) && codecs[c].maxinput > lookback)
+			lookback = codecs[c].maxinput;
+	}
+	return lookback;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Allocates pre-pass tables with room for a number of offsets, for each codec that needs one.
+static void tables_alloc(const sniff_t *this, sniff_tables_t *tables, size_t size) {
+	for (int c = 0; c < CODEC_COUNT; c++) {
+		tables->table[c] = NULL;
+		if (!(this->codecs & (1 << c)) || !codecs[c].scan) continue;
+		
+		if (!(tables->table[c] = malloc((size ? size : 1) * sizeof(scan_entry_t)))) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+static void tables_free(sniff_tables_t *tables) {
+	for (int c = 0; c < CODEC_COUNT; c++) {
+		free(tables->table[c]);
+		tables->table[c] = NULL;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Runs each codec's pre-pass over a range of offsets [start, end). Since data can be up to 64 kb
+// long, the pre-pass also includes up to 64 kb past the end of the range.
+// The tables need room for end - start + 64 kb entries.
+static void sniff_prepass(const sniff_t *this, const sniff_tables_t *tables, size_t start, size_t end) {
+	size_t slice = (end + DATA_SIZE < this->rom->size ? end + DATA_SIZE : this->rom->size) - start;
+	
+	for (int c = 0; c < CODEC_COUNT; c++) {
+		if (tables->table[c])
+			codecs[c].scan(this->rom->data + start, slice, tables->table[c]);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks every offset from first to last-1 for valid compressed data in each format (without
+// actually decompressing it). tables has the pre-pass results starting from offset base.
+static void sniff_check(const sniff_t *this, const sniff_tables_t *tables, size_t base,
+                        size_t first, size_t last, sniff_index_t *results) {
+	unpack_stats_t stats;
+	
+	for (size_t i = first; i < last; i++) {
+		for (int c = 0; c < CODEC_COUNT; c++) {
+			if (!(this->codecs & (1 << c))) continue;
+			
+			// quickly skip anything that the pre-pass already ruled out
+			if (tables->table[c]) {
+				const scan_entry_t *entry = &tables->table[c][i - base];
+				if (!entry->inputsize || !sniff_candidate(this, entry->inputsize, entry->outputsize))
+					continue;
+			}
+			
+			size_t outputsize = codecs[c].probe(this->rom, i, &stats, &this->options);
+			
+			if (outputsize && sniff_candidate(this, stats.inputsize, outputsize))
+				sniff_add(results, i, c, outputsize, &stats);
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks every offset in a range of chunks.
+static void sniff_chunks(void *arg, size_t start, size_t end, int thread) {
+	sniff_t *this = (sniff_t*)arg;
+	
+	for (size_t c = start; c < end; c++) {
+		size_t first = this->start + c * CHUNK_SIZE;
+		size_t last  = first + CHUNK_SIZE < this->end ? first + CHUNK_SIZE : this->end;
+		
+		sniff_check(this, &this->tables, this->start, first, last, &this->chunks[c]);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks offsets in order on a single thread, jumping straight past the data for each result
+// once it's found, so that nothing inside of it needs to be checked.
+static void sniff_skip(sniff_t *this) {
+	for (size_t i = this->start; i < this->end; i++) {
+		sniff_index_t *chunk = &this->chunks[(i - this->start) / CHUNK_SIZE];
+		size_t count = chunk->count;
+		
+		sniff_check(this, &this->tables, this->start, i, i + 1, chunk);
+		// skip over the data for the first result found here
+		if (chunk->count > count)
+			i += chunk->results[count].inputsize - 1;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Only checks offsets which are referenced by calls to known decompression routines.
+static void sniff_refs(sniff_t *this, map_e map, const uint32_t *routines, size_t numroutines,
+                       int threads) {
+	ref_t *refs;
+	size_t count = refs_find(this->rom, map, routines, numroutines, &refs);
+	unpack_job_t *jobs = calloc(count ? count : 1, sizeof(unpack_job_t));
+	
+	if (!jobs) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (size_t i = 0; i < count; i++) {
+		jobs[i].packed  = rom_packed(this->rom, refs[i].offset);
+		jobs[i].options = &this->options;
+	}
+	exhal_unpack_batch(jobs, count, threads);
+	
+	for (size_t i = 0; i < count; i++) {
+		if (jobs[i].outputsize && sniff_candidate(this, jobs[i].stats.inputsize, jobs[i].outputsize)) {
+			printf("%06x: %u -> %u bytes (referenced at %06x)\n", (unsigned)refs[i].offset,
+			       (unsigned)jobs[i].stats.inputsize, (unsigned)jobs[i].outputsize,
+			       (unsigned)refs[i].source);
+		}
+	}
+	
+	free(jobs);
+	free(refs);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Finds all results in the range of offsets being checked. If skip is set, offsets are checked in
+// order on one thread (skipping over each result as in sniff_skip) instead of in parallel.
+static void sniff_scan(sniff_t *this, sniff_index_t *index, int threads, int skip) {
+	size_t numchunks = (this->end - this->start + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	
+	tables_alloc(this, &this->tables, this->end - this->start + DATA_SIZE);
+	this->chunks = calloc(numchunks ? numchunks : 1, sizeof(sniff_index_t));
+	if (!this->chunks) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	// find out where valid data might be in a single pass, then check each possible offset
+	sniff_prepass(this, &this->tables, this->start, this->end);
+	if (skip)
+		sniff_skip(this);
+	else
+		pool_run(numchunks, 1, threads, sniff_chunks, this);
+	
+	for (size_t c = 0; c < numchunks; c++) {
+		for (size_t i = 0; i < this->chunks[c].count; i++)
+			index_add(index, &this->chunks[c].results[i]);
+		index_free(&this->chunks[c]);
+	}
+	
+	tables_free(&this->tables);
+	free(this->chunks);
+}
+
+// ------------------------------------------------------------------------------------------------
+static int range_compare(const void *a, const void *b) {
+	const sniff_range_t *ra = (const sniff_range_t*)a, *rb = (const sniff_range_t*)b;
+	
+	if (ra->start != rb->start) return ra->start < rb->start ? -1 : 1;
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Updates the results from a previous scan of the ROM after some parts of it were changed.
+// Data at an offset can't be longer than the largest compressed size accepted by any of the codecs
+// being used (see sniff_lookback: 64 kb for HAL's format, or about 288 kb with lz10), so the only
+// results which can change are the ones inside of a changed range, or within that distance before
+// one; everything else is copied from the old results, and only the affected offsets are checked
+// again.
+static void sniff_update(sniff_t *this, const sniff_index_t *old, sniff_range_t *ranges, size_t numranges,
+                         sniff_index_t *index) {
+	size_t numaffected = 0, maxslice = 0;
+	size_t lookback = sniff_lookback(this);
+	
+	// if the file changed size, then anything near the end of the old/new file is affected too
+	if (old->romsize != this->rom->size) {
+		ranges[numranges].start = old->romsize < this->rom->size ? old->romsize : this->rom->size;
+		ranges[numranges].end   = old->romsize < this->rom->size ? this->rom->size : old->romsize;
+		numranges++;
+	}
+	
+	// find and combine the affected ranges
+	for (size_t i = 0; i < numranges; i++) {
+		ranges[i].start = ranges[i].start > lookback - 1 ? ranges[i].start - (lookback - 1) : 0;
+		if (ranges[i].end > this->rom->size) ranges[i].end = this->rom->size;
+	}
+	qsort(ranges, numranges, sizeof(sniff_range_t), range_compare);
+	
+	for (size_t i = 0; i < numranges; i++) {
+		if (ranges[i].start >= ranges[i].end) continue;
+		
+		if (numaffected && ranges[i].start <= ranges[numaffected - 1].end) {
+			if (ranges[i].end > ranges[numaffected - 1].end)
+				ranges[numaffected - 1].end = ranges[i].end;
+		} else {
+			ranges[numaffected++] = ranges[i];
+		}
+	}
+	
+	// each affected range needs to be scanned along with the 64 kb after it
+	for (size_t i = 0; i < numaffected; i++) {
+		size_t slice = ranges[i].end - ranges[i].start + DATA_SIZE;
+		if (slice > maxslice) maxslice = slice;
+	}
+	tables_alloc(this, &this->tables, maxslice);
+	
+	size_t next = 0;
+	for (size_t r = 0; r <= numaffected; r++) {
+		size_t start = r < numaffected ? ranges[r].start : this->rom->size;
+		size_t end   = r < numaffected ? ranges[r].end   : this->rom->size;
+		
+		// keep the old results from before this range
+		for (; next < old->count && old->results[next].offset < start; next++)
+			index_add(index, &old->results[next]);
+		for (; next < old->count && old->results[next].offset < end; next++);
+		
+		if (r == numaffected) break;
+		
+		sniff_prepass(this, &this->tables, start, end);
+		sniff_check(this, &this->tables, start, start, end, index);
+	}
+	
+	tables_free(&this->tables);
+}
+
+// ------------------------------------------------------------------------------------------------
+static int shard_compare(const void *a, const void *b) {
+	const sniff_index_t *ia = (const sniff_index_t*)a, *ib = (const sniff_index_t*)b;
+	
+	if (ia->start != ib->start) return ia->start < ib->start ? -1 : 1;
+	return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Combines the results from several scans of different ranges of the same ROM (with -range)
+// into the same results as a scan of the entire ROM.
+static void sniff_merge(char **paths, size_t count, sniff_index_t *index) {
+	sniff_index_t *shards = calloc(count ? count : 1, sizeof(sniff_index_t));
+	if (!shards) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	for (size_t i = 0; i < count; i++) {
+		if (!index_read(&shards[i], paths[i])) {
+			fprintf(stderr, "Error: unable to read index %s\n", paths[i]);
+			exit(-1);
+		}
+		if (shards[i].romhash != shards[0].romhash || shards[i].romsize != shards[0].romsize
+		    || !index_params_match(&shards[i].params, &shards[0].params)) {
+			fprintf(stderr, "Error: %s is from a different ROM or with different settings than %s\n",
+			        paths[i], paths[0]);
+			exit(-1);
+		}
+	}
+	qsort(shards, count, sizeof(sniff_index_t), shard_compare);
+	
+	*index = shards[0];
+	index->results = NULL;
+	index->count = index->alloc = 0;
+	index->start = index->end = 0;
+	
+	for (size_t i = 0; i < count; i++) {
+		// every offset has to be checked exactly once
+		if (shards[i].start != index->end) {
+			fprintf(stderr, "Error: offsets %06x to %06x are %s\n",
+			        (unsigned)(shards[i].start < index->end ? shards[i].start : index->end),
+			        (unsigned)(shards[i].start < index->end ? index->end : shards[i].start),
+			        shards[i].start < index->end ? "in more than one index" : "missing");
+			exit(-1);
+		}
+		
+		for (size_t j = 0; j < shards[i].count; j++)
+			index_add(index, &shards[i].results[j]);
+		index->end = shards[i].end;
+		index_free(&shards[i]);
+	}
+	
+	if (index->end != index->romsize) {
+		fprintf(stderr, "Error: offsets %06x to %06x are missing\n",
+		        (unsigned)index->end, (unsigned)index->romsize);
+		exit(-1);
+	}
+	free(shards);
+}
+
+// ------------------------------------------------------------------------------------------------
+static int name_compare(const void *a, const void *b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Adds a ROM, every file in a directory (including subdirectories), or every file listed in
+// a text file (if the name starts with @) to a collection.
+static void collection_add(sniff_collection_t *this, const char *path) {
+	struct stat st;
+	
+	if (*path == '@') {
+		FILE *list = fopen(path + 1, "r");
+		char  line[4096];
+		
+		if (!list) {
+			fprintf(stderr, "Error: unable to open %s\n", path + 1);
+			exit(-1);
+		}
+		while (fgets(line, sizeof(line), list)) {
+			line[strcspn(line, "\r\n")] = 0;
+			if (*line) collection_add(this, line);
+		}
+		fclose(list);
+		
+	} else if (!stat(path, &st) && S_ISDIR(st.st_mode)) {
+		DIR *dir = opendir(path);
+		struct dirent *entry;
+		char **names = NULL;
+		size_t count = 0;
+		
+		if (!dir) {
+			fprintf(stderr, "Warning: unable to open directory %s\n", path);
+			return;
+		}
+		while ((entry = readdir(dir))) {
+			if (entry->d_name[0] == '.') continue;
+			
+			names = realloc(names, (count + 1) * sizeof(char*));
+			names[count] = malloc(strlen(path) + strlen(entry->d_name) + 2);
+			if (!names || !names[count]) {
+				fprintf(stderr, "Error: out of memory\n");
+				exit(-1);
+			}
+			sprintf(names[count++], "%s/%s", path, entry->d_name);
+		}
+		closedir(dir);
+		
+		// list files in a consistent order
+		qsort(names, count, sizeof(char*), name_compare);
+		for (size_t i = 0; i < count; i++) {
+			collection_add(this, names[i]);
+			free(names[i]);
+		}
+		free(names);
+		
+	} else {
+		if (this->numfiles == this->allocfiles) {
+			this->allocfiles = this->allocfiles ? 2 * this->allocfiles : 16;
+			this->files = realloc(this->files, this->allocfiles * sizeof(sniff_file_t));
+			if (!this->files) {
+				fprintf(stderr, "Error: out of memory\n");
+				exit(-1);
+			}
+		}
+		
+		sniff_file_t *file = &this->files[this->numfiles];
+		memset(file, 0, sizeof(*file));
+		if (stat(path, &st) || access(path, R_OK)) {
+			fprintf(stderr, "Warning: unable to open %s\n", path);
+			return;
+		}
+		file->path = strdup(path);
+		file->size = st.st_size;
+		this->numfiles++;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+static rom_t* collection_open(const sniff_file_t *file) {
+	rom_t *rom = rom_open(file->path, 0);
+	
+	if (!rom) {
+		fprintf(stderr, "Error: unable to open %s\n", file->path);
+		exit(-1);
+	}
+	return rom;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void collection_hash(void *arg, size_t start, size_t end, int thread) {
+	sniff_collection_t *this = (sniff_collection_t*)arg;
+	
+	for (size_t i = start; i < end; i++) {
+		sniff_file_t *file = &this->files[i];
+		rom_t *rom = collection_open(file);
+		
+		file->size = rom->size;
+		file->hash = hash64(rom->data, rom->size, 0);
+		rom_close(rom);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks whether two files with the same size and hash actually have the same contents.
+static int collection_same(const sniff_file_t *a, const sniff_file_t *b) {
+	if (!a->size) return 1;
+	
+	rom_t *roma = collection_open(a), *romb = collection_open(b);
+	int same = roma->size == romb->size && !memcmp(roma->data, romb->data, roma->size);
+	
+	rom_close(roma);
+	rom_close(romb);
+	return same;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Checks every offset in a range of jobs (chunks of files).
+static void collection_chunks(void *arg, size_t start, size_t end, int thread) {
+	sniff_collection_t *this = (sniff_collection_t*)arg;
+	
+	sniff_tables_t *tables = &this->tables[thread];
+	
+	for (size_t j = start; j < end; j++) {
+		sniff_job_t  *job = &this->jobs[j];
+		sniff_file_t *file = job->file;
+		const sniff_t *sniff = &file->sniff;
+		size_t last = job->start + FILE_CHUNK_SIZE < sniff->end ? job->start + FILE_CHUNK_SIZE : sniff->end;
+		
+		// the file is opened by the first of its jobs to start, and closed by the last to finish
+		pthread_mutex_lock(&this->lock);
+		if (!file->rom) {
+			file->rom = collection_open(file);
+			if (file->rom->size != file->size) {
+				fprintf(stderr, "Error: %s changed during the scan\n", file->path);
+				exit(-1);
+			}
+			file->sniff.rom = file->rom;
+		}
+		pthread_mutex_unlock(&this->lock);
+		
+		// all files use the same codecs, so the tables are the same too
+		if (!tables->allocated) {
+			tables_alloc(sniff, tables, FILE_CHUNK_SIZE + DATA_SIZE);
+			tables->allocated = 1;
+		}
+		
+		sniff_prepass(sniff, tables, job->start, last);
+		sniff_check(sniff, tables, job->start, job->start, last, &job->results);
+		
+		pthread_mutex_lock(&this->lock);
+		if (!--file->pending) {
+			rom_close(file->rom);
+			file->rom = NULL;
+		}
+		pthread_mutex_unlock(&this->lock);
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Scans several ROMs at once using the same threads. Each ROM is split into chunks of the same size,
+// so the work is spread evenly no matter how large each ROM is.
+// ROMs with the same contents as another one are only scanned once.
+static void collection_scan(sniff_collection_t *this, const sniff_t *base, const char *cachedir,
+                            int threads) {
+	this->tables = calloc(threads, sizeof(sniff_tables_t));
+	if (!this->tables) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	pool_run(this->numfiles, 1, threads, collection_hash, this);
+	
+	for (size_t i = 0; i < this->numfiles; i++) {
+		sniff_file_t *file = &this->files[i];
+		
+		file->same = i;
+		for (size_t j = 0; j < i; j++) {
+			const sniff_file_t *other = &this->files[j];
+			
+			if (other->same == j && other->hash == file->hash && other->size == file->size
+			    && collection_same(other, file)) {
+				file->same = j;
+				break;
+			}
+		}
+	}
+	
+	for (size_t i = 0; i < this->numfiles; i++) {
+		sniff_file_t *file = &this->files[i];
+		if (file->same != i) continue;
+		
+		file->sniff     = *base;
+		file->sniff.rom = NULL;
+		file->sniff.end = file->size;
+		
+		file->index.romhash = file->hash;
+		file->index.romsize = file->size;
+		file->index.end     = file->size;
+		file->index.params  = sniff_params(&file->sniff);
+		
+		if (cachedir) {
+			char *cachepath = index_cache_path(&file->index, cachedir);
+			sniff_index_t old;
+			
+			if (index_read(&old, cachepath)) {
+				if (index_matches(&old, &file->index)) {
+					file->index  = old;
+					file->cached = 1;
+				} else {
+					index_free(&old);
+				}
+			}
+			free(cachepath);
+			if (file->cached) continue;
+		}
+		
+		for (size_t start = 0; start < file->size; start += FILE_CHUNK_SIZE) {
+			if (this->numjobs == this->allocjobs) {
+				this->allocjobs = this->allocjobs ? 2 * this->allocjobs : 64;
+				this->jobs = realloc(this->jobs, this->allocjobs * sizeof(sniff_job_t));
+				if (!this->jobs) {
+					fprintf(stderr, "Error: out of memory\n");
+					exit(-1);
+				}
+			}
+			
+			sniff_job_t *job = &this->jobs[this->numjobs++];
+			memset(job, 0, sizeof(*job));
+			job->file  = file;
+			job->start = start;
+			file->pending++;
+		}
+	}
+	
+	pthread_mutex_init(&this->lock, NULL);
+	pool_run(this->numjobs, 1, threads, collection_chunks, this);
+	pthread_mutex_destroy(&this->lock);
+	
+	// put each file's results back together (the jobs for each file are already in order)
+	for (size_t j = 0; j < this->numjobs; j++) {
+		sniff_job_t *job = &this->jobs[j];
+		
+		for (size_t i = 0; i < job->results.count; i++)
+			index_add(&job->file->index, &job->results.results[i]);
+		index_free(&job->results);
+	}
+	
+	for (size_t i = 0; cachedir && i < this->numfiles; i++) {
+		sniff_file_t *file = &this->files[i];
+		if (file->same != i || file->cached) continue;
+		
+		char *cachepath = index_cache_path(&file->index, cachedir);
+		if (!index_write(&file->index, cachepath))
+			fprintf(stderr, "Warning: unable to save results to %s\n", cachepath);
+		free(cachepath);
+	}
+	
+	for (int i = 0; i < threads; i++)
+		tables_free(&this->tables[i]);
+	free(this->tables);
+	free(this->jobs);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Outputs all results in order. With -skip, anything inside of another result is left out
+// (or marked as nested).
+static void sniff_print(const sniff_t *this, const sniff_index_t *index) {
+	size_t end = 0;
+	
+	for (size_t i = 0; i < index->count; i++) {
+		const sniff_result_t *result = &index->results[i];
+		int nested = this->skip && result->offset < end;
+		
+		if (nested && !this->nested) continue;
+		if (!nested) end = result->offset + result->inputsize;
+		
+		printf("%s%06x: %u -> %u bytes", nested ? "  " : "", (unsigned)result->offset,
+		       (unsigned)result->inputsize, (unsigned)result->outputsize);
+		if (result->codec != CODEC_HAL && result->codec < CODEC_COUNT)
+			printf(" (%s)", codecs[result->codec].name);
+		printf("%s\n", nested ? " (nested)" : "");
+	}
+}
 
 int main (int argc, char **argv) {
 	printf("sniff - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n");
 	
-	if (argc != 2) {
-		fprintf(stderr, "Usage:\n%s romfile offset outfile\n"
-		                "Example: %s kirbybowl.sfc\n",
-		                argv[0], argv[0]);
+	if (argc < 2) {
+		fprintf(stderr, "Usage:\n%s [options] romfile\n"
+		                "%s [options] romfile|directory|@listfile...\n"
+		                "%s [options] -merge indexfile...\n"
+		                "Example: %s kirbybowl.sfc\n\n"
+		                "Options:\n"
+		                "-j n     number of threads to use (default: one per CPU)\n"
+		                "-skip    skip over the data at each offset found, instead of also checking\n"
+		                "         every offset inside of it (checks offsets in order on one thread)\n"
+		                "-nested  with -skip, still report the offsets inside of each one found\n"
+		                "-strict  reject data with back references to data which hasn't been output yet\n"
+		                "-min n   minimum uncompressed size (default 1024 bytes)\n"
+		                "-max n   maximum compressed size\n"
+		                "-ratio x minimum compression ratio (uncompressed / compressed size)\n"
+		                "-codec name[,name...]\n"
+		                "         compression formats to look for: hal (default), lz10 (GBA/DS BIOS LZ77)\n"
+		                "-refs    only check data passed to known decompression routines (see\n"
+		                "         gamenotes.txt) instead of every offset\n"
+		                "-map m   with -refs, the ROM's memory map (lorom, hirom or gb; default: auto)\n"
+		                "-routine addr\n"
+		                "         with -refs, address of a decompression routine to look for\n"
+		                "         (can be used more than once; replaces the built-in list)\n"
+		                "-cache dir\n"
+		                "         save results to (or load them from) an index in a directory, based on\n"
+		                "         the ROM's contents and the options above\n"
+		                "-o file  save results to an index file\n"
+		                "-update file\n"
+		                "         update the results from an index file (saved with -o or -cache) instead\n"
+		                "         of scanning the whole ROM; use with -dirty\n"
+		                "-dirty start:end[,start:end...]\n"
+		                "         with -update, ranges of offsets which have changed since then\n"
+		                "-range start:end\n"
+		                "         only check offsets in a range (use with -o to save the results, then\n"
+		                "         combine the results from each range with -merge)\n"
+		                "-merge   combine the results from index files saved with -range, and print\n"
+		                "         them (or save them with -o) the same as a scan of the entire ROM\n",
+		                argv[0], argv[0], argv[0], argv[0]);
 		exit(-1);
 	}
 	
-	FILE   *infile;
+	int threads = 0;
+	sniff_t sniff = {0};
+	sniff.codecs = 1 << CODEC_HAL;
+	// default min. size only applies when checking every offset
+	long minsize = -1;
+	// used with -refs
+	int refs = 0, map = -1, codecset = 0;
+	uint32_t *routines = malloc(argc * sizeof(uint32_t));
+	size_t numroutines = 0;
+	const char *cachedir = NULL, *outpath = NULL, *updatepath = NULL;
+	sniff_range_t ranges[MAX_RANGES + 1];
+	size_t numranges = 0;
+	// used with -range and -merge
+	size_t rangestart = 0, rangeend = SIZE_MAX;
+	int merge = 0;
+	
+	if (!routines) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	
+	int i;
+	for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-merge")) {
+			// everything after this is an index file
+			merge = i + 1;
+			break;
+		} else if (!strcmp(argv[i], "-j") && i < argc - 2) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-skip")) {
+			sniff.skip = 1;
+		} else if (!strcmp(argv[i], "-nested")) {
+			sniff.nested = 1;
+		} else if (!strcmp(argv[i], "-strict")) {
+			sniff.options.strict = 1;
+		} else if (!strcmp(argv[i], "-min") && i < argc - 2) {
+			minsize = strtol(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-max") && i < argc - 2) {
+			sniff.options.maxinput = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-ratio") && i < argc - 2) {
+			sniff.options.minratio = strtod(argv[++i], NULL);
+		} else if (!strcmp(argv[i], "-codec") && i < argc - 2) {
+			char *name = argv[++i];
+			
+			sniff.codecs = 0;
+			codecset = 1;
+			while (*name) {
+				size_t length = strcspn(name, ",");
+				int c;
+				
+				for (c = 0; c < CODEC_COUNT; c++) {
+					if (strlen(codecs[c].name) == length && !strncmp(name, codecs[c].name, length))
+						break;
+				}
+				if (c == CODEC_COUNT) {
+					fprintf(stderr, "Error: unknown codec %.*s\n", (int)length, name);
+					exit(-1);
+				}
+				
+				sniff.codecs |= 1 << c;
+				name += length;
+				if (*name == ',') name++;
+			}
+		} else if (!strcmp(argv[i], "-refs")) {
+			refs = 1;
+		} else if (!strcmp(argv[i], "-map") && i < argc - 2) {
+			i++;
+			for (map = 0; map < MAP_COUNT && strcmp(argv[i], map_names[map]); map++);
+			if (map == MAP_COUNT) {
+				fprintf(stderr, "Error: unknown memory map %s\n", argv[i]);
+				exit(-1);
+			}
+		} else if (!strcmp(argv[i], "-cache") && i < argc - 2) {
+			cachedir = argv[++i];
+		} else if (!strcmp(argv[i], "-o") && i < argc - 2) {
+			outpath = argv[++i];
+		} else if (!strcmp(argv[i], "-update") && i < argc - 2) {
+			updatepath = argv[++i];
+		} else if (!strcmp(argv[i], "-range") && i < argc - 2) {
+			char *range = argv[++i];
+			
+			rangestart = strtoul(range, &range, 0);
+			if (*range++ != ':') {
+				fprintf(stderr, "Error: invalid range %s\n", argv[i]);
+				exit(-1);
+			}
+			rangeend = strtoul(range, NULL, 0);
+		} else if (!strcmp(argv[i], "-dirty") && i < argc - 2) {
+			char *range = argv[++i];
+			
+			while (*range) {
+				if (numranges == MAX_RANGES) {
+					fprintf(stderr, "Error: too many ranges (max %d)\n", MAX_RANGES);
+					exit(-1);
+				}
+				ranges[numranges].start = strtoul(range, &range, 0);
+				if (*range++ != ':') {
+					fprintf(stderr, "Error: invalid range %s\n", argv[i]);
+					exit(-1);
+				}
+				ranges[numranges].end = strtoul(range, &range, 0);
+				if (*range == ',') range++;
+				numranges++;
+			}
+		} else if (!strcmp(argv[i], "-routine") && i < argc - 2) {
+			// allow addresses written as $xxxxxx
+			const char *addr = argv[++i];
+			routines[numroutines++] = *addr == '$' ? strtoul(addr + 1, NULL, 16) : strtoul(addr, NULL, 0);
+		}
+	}
+	if (threads <= 0) threads = pool_default_threads();
+	if (numranges && !updatepath) {
+		fprintf(stderr, "Error: -dirty can only be used with -update\n");
+		exit(-1);
+	}
+	if (refs && (outpath || cachedir || updatepath || codecset || rangeend != SIZE_MAX || merge)) {
+		fprintf(stderr, "Error: -refs can't be used with -o, -cache, -codec, -update, -range or -merge\n");
+		exit(-1);
+	}
+	
+	sniff_index_t index = {0};
+	struct stat st;
+	
+	sniff.minsize = minsize >= 0 ? minsize : 1024;
+	
+	if (!merge && (argc - i > 1 || argv[i][0] == '@' || (!stat(argv[i], &st) && S_ISDIR(st.st_mode)))) {
+		// scan several ROMs at once
+		sniff_collection_t collection = {0};
+		size_t unique = 0, total = 0;
+		
+		free(routines);
+		if (refs || outpath || updatepath || rangeend != SIZE_MAX) {
+			fprintf(stderr, "Error: -refs, -o, -update and -range can only be used with a single ROM\n");
+			exit(-1);
+		}
+		
+		for (; i < argc; i++)
+			collection_add(&collection, argv[i]);
+		collection_scan(&collection, &sniff, cachedir, threads);
+		
+		for (size_t f = 0; f < collection.numfiles; f++) {
+			sniff_file_t *file = &collection.files[f];
+			
+			if (file->same != f) {
+				printf("%s: %u bytes, same as %s\n\n", file->path, (unsigned)file->size,
+				       collection.files[file->same].path);
+			} else {
+				printf("%s: %u bytes, %u results\n", file->path, (unsigned)file->size,
+				       (unsigned)file->index.count);
+				sniff_print(&sniff, &file->index);
+				printf("\n");
+				
+				unique++;
+				total += file->index.count;
+				index_free(&file->index);
+			}
+			
+		}
+		printf("%u files (%u unique), %u results\n", (unsigned)collection.numfiles,
+		       (unsigned)unique, (unsigned)total);
+		
+		for (size_t f = 0; f < collection.numfiles; f++)
+			free(collection.files[f].path);
+		free(collection.files);
+		return 0;
+	}
+	
+	if (merge) {
+		free(routines);
+		
+		sniff_merge(argv + merge, argc - merge, &index);
+		if (outpath && !index_write(&index, outpath)) {
+			fprintf(stderr, "Error: unable to save results to %s\n", outpath);
+			exit(-1);
+		}
+		sniff_print(&sniff, &index);
+		
+		index_free(&index);
+		return 0;
+	}
+	
+	rom_t  *rom;
 	
 	// open ROM file for input
-	infile = fopen(argv[1], "rb");
-	if (!infile) {
-		fprintf(stderr, "Error: unable to open %s\n", argv[1]);
+	rom = rom_open(argv[argc - 1], 0);
+	if (!rom) {
+		fprintf(stderr, "Error: unable to open %s\n", argv[argc - 1]);
 		exit(-1);
 	}
 	
-	size_t   outputsize, filesize;
-	uint8_t  unpacked[DATA_SIZE] = {0};
-	unpack_stats_t stats;
+	if (refs) {
+		if (map < 0) map = refs_detect_map(rom);
+		sniff.rom     = rom;
+		sniff.minsize = minsize >= 0 ? minsize : 0;
+		
+		if (numroutines)
+			sniff_refs(&sniff, map, routines, numroutines, threads);
+		else
+			sniff_refs(&sniff, map, known_routines, num_known_routines, threads);
+		
+		free(routines);
+		rom_close(rom);
+		return 0;
+	}
+	free(routines);
+	
+	char *cachepath = NULL;
+	
+	if (rangeend > rom->size) rangeend = rom->size;
+	if (rangestart > rangeend) rangestart = rangeend;
+	if ((rangestart || rangeend < rom->size) && (cachedir || updatepath)) {
+		fprintf(stderr, "Error: -range can't be used with -cache or -update\n");
+		exit(-1);
+	}
 	
-	// decompress the file
-	fseek(infile, 0, SEEK_END);
-	filesize = ftell(infile);
+	sniff.rom     = rom;
+	sniff.start   = rangestart;
+	sniff.end     = rangeend;
 	
-	for (int i = 0; i < filesize; i++) {
-		fseek(infile, i, SEEK_SET);
-		outputsize = exhal_unpack_from_file(infile, i, unpacked, &stats);
+	index.romsize = rom->size;
+	index.start   = rangestart;
+	index.end     = rangeend;
+	index.params  = sniff_params(&sniff);
+	
+	if (cachedir || updatepath || outpath)
+		index.romhash = hash64(rom->data, rom->size, 0);
+	if (cachedir)
+		cachepath = index_cache_path(&index, cachedir);
+	
+	int cached = 0;
+	if (updatepath) {
+		sniff_index_t old;
+		
+		if (!index_read(&old, updatepath)) {
+			fprintf(stderr, "Error: unable to read index %s\n", updatepath);
+			exit(-1);
+		}
+		if (old.start || old.end != old.romsize) {
+			fprintf(stderr, "Error: %s only has results for part of the ROM\n", updatepath);
+			exit(-1);
+		}
+		// only the settings have to match, since the ROM itself has probably changed
+		if (!index_params_match(&old.params, &index.params)) {
+			fprintf(stderr, "Error: %s was saved with different -strict/-min/-max/-ratio settings\n",
+			        updatepath);
+			exit(-1);
+		}
+		
+		sniff_update(&sniff, &old, ranges, numranges, &index);
+		index_free(&old);
 		
-		if (outputsize > stats.inputsize
-			&& outputsize >= 1024 /* TODO set minimum sizes/ratio/etc */) {
-			printf("%06x: %u -> %u bytes\n", i, (unsigned)stats.inputsize, (unsigned)outputsize);
+	} else if (cachepath) {
+		// look for results from a previous scan first
+		sniff_index_t old;
+		
+		if (index_read(&old, cachepath)) {
+			if (index_matches(&old, &index)) {
+				index  = old;
+				cached = 1;
+			} else {
+				index_free(&old);
+			}
 		}
 	}
 	
-	fclose(infile);
+	if (!updatepath && !cached) {
+		// saved results always include nested ones, since they're only left out when printing.
+		// -nested needs every offset checked anyway, so only plain -skip is faster in order
+		sniff_scan(&sniff, &index, threads, sniff.skip && !sniff.nested && !cachepath && !outpath);
+	}
+	
+	if (cachepath && !cached && !index_write(&index, cachepath))
+		fprintf(stderr, "Warning: unable to save results to %s\n", cachepath);
+	if (outpath && !index_write(&index, outpath)) {
+		fprintf(stderr, "Error: unable to save results to %s\n", outpath);
+		exit(-1);
+	}
+	
+	sniff_print(&sniff, &index);
+	
+	index_free(&index);
+	free(cachepath);
+	rom_close(rom);
 }
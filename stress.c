@@ -0,0 +1,189 @@
+/*
+	exhal / inhal compression stress test
+	
+	Copyright (c) 2013-2018 Devin Acker
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+#include "corpus.h"
+#include "timer.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+// compression levels (same as inhal's -1 to -4)
+#define LEVELS 4
+
+// size of the data generated for each test
+#define STRESS_SIZE 2048
+
+// give up completely once a test takes this many times longer than its budget
+#define ABORT_FACTOR 10
+
+// the longest each kind of data may take to compress at each level, in seconds
+// (about three times as long as it currently takes on a typical desktop CPU; use -scale to adjust)
+typedef struct {
+	const char *name;
+	double budget[LEVELS];
+} stress_budget_t;
+
+static const stress_budget_t budgets[] = {
+	{"zero",       {0.1, 0.1, 15, 25}},
+	{"period2",    {0.1, 0.1, 6, 6}},
+	{"period3",    {0.1, 0.1, 6, 6}},
+	{"period4",    {0.1, 0.1, 5, 5}},
+	{"sequence",   {0.1, 0.1, 0.5, 0.5}},
+	{"sequence16", {0.1, 0.1, 0.1, 0.1}},
+	{"neartiles",  {0.1, 0.1, 0.5, 0.5}},
+	{"mirror",     {0.1, 0.1, 1.5, 1.5}},
+};
+#define NUM_BUDGETS (sizeof(budgets) / sizeof(budgets[0]))
+
+#ifndef _WIN32
+// message shown if the test currently running takes too long
+// (prepared ahead of time, since stdio can't be used from the alarm handler)
+static char   timeout_message[128];
+static size_t timeout_length;
+
+// ------------------------------------------------------------------------------------------------
+static void stress_timeout(int sig) {
+	ssize_t written = write(2, timeout_message, timeout_length);
+	
+	(void)sig;
+	(void)written;
+	_exit(-1);
+}
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// Compresses one kind of data at one level and prints the results.
+// Returns 0 if it took longer than its budget or didn't decompress correctly.
+static int stress_run(const corpus_class_t *type, int level, double budget) {
+	static uint8_t unpacked[DATA_SIZE], packed[DATA_SIZE], check[DATA_SIZE];
+	pack_options_t options = {
+		.fast    = level == 1 || level == 3,
+		.optimal = level >= 3,
+	};
+	int ok = 1;
+	
+	type->generate(unpacked, STRESS_SIZE, 1);
+#ifndef _WIN32
+	// no alarms on Windows; the budget is still checked once compression is done
+	snprintf(timeout_message, sizeof(timeout_message),
+	         "Error: %s -%d took over %dx its time budget, giving up\n", type->name, level, ABORT_FACTOR);
+	timeout_length = strlen(timeout_message);
+	alarm((unsigned)(budget * ABORT_FACTOR) + 1);
+#endif
+
+	double time = timer_now();
+	size_t packedsize = exhal_pack2(unpacked, STRESS_SIZE, packed, &options);
+	time = timer_now() - time;
+#ifndef _WIN32
+	alarm(0);
+#endif
+
+	memset(check, 0, DATA_SIZE);
+	if (!packedsize || exhal_unpack(packed, check, NULL) != STRESS_SIZE
+	    || memcmp(check, unpacked, STRESS_SIZE)) {
+		fprintf(stderr, "Error: %s did not decompress correctly at level %d\n", type->name, level);
+		ok = 0;
+	}
+	if (time > budget) ok = 0;
+	
+	printf("%-12s -%d %7lu %10.3f %10.3f  %s\n", type->name, level, (unsigned long)packedsize,
+	       time, budget, ok ? "ok" : "FAILED");
+	fflush(stdout);
+	return ok;
+}
+
+int main (int argc, char **argv) {
+	const char *only = NULL;
+	double scale = 1;
+	int    failed = 0, onlylevel = 0;
+	
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-scale") && i < argc - 1) {
+			scale = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-class") && i < argc - 1) {
+			size_t j;
+			
+			only = argv[++i];
+			for (j = 0; j < NUM_BUDGETS && strcmp(only, budgets[j].name); j++);
+			if (j == NUM_BUDGETS) {
+				fprintf(stderr, "Error: unknown class %s\n", only);
+				exit(-1);
+			}
+		} else if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '4' && !argv[i][2]) {
+			onlylevel = argv[i][1] - '0';
+		} else {
+			scale = 0;
+			break;
+		}
+	}
+	
+	if (scale <= 0) {
+		fprintf(stderr, "halstress - " __DATE__ " " __TIME__"\nby Devin Acker (Revenant)\n\n"
+		                "Usage:\n%s [-scale x] [-class name] [-1|-2|-3|-4]\n\n"
+		                "Compresses %d bytes of each kind of pathological data at each level, and\n"
+		                "fails if any of them take longer than their time budget (multiplied by x).\n"
+		                "Classes:",
+		                argv[0], STRESS_SIZE);
+		for (size_t i = 0; i < NUM_BUDGETS; i++)
+			fprintf(stderr, " %s", budgets[i].name);
+		fprintf(stderr, "\n");
+		exit(-1);
+	}
+
+#ifndef _WIN32
+	signal(SIGALRM, stress_timeout);
+#endif
+	printf("class     level  packed   time (s) budget (s)\n");
+	
+	for (size_t i = 0; i < NUM_BUDGETS; i++) {
+		const corpus_class_t *type = corpus_find(corpus_pathological, corpus_num_pathological,
+		                                         budgets[i].name);
+		if (only && strcmp(only, budgets[i].name)) continue;
+		if (!type) {
+			fprintf(stderr, "Error: unknown class %s\n", budgets[i].name);
+			exit(-1);
+		}
+		
+		for (int level = 1; level <= LEVELS; level++) {
+			if (onlylevel && level != onlylevel) continue;
+			failed += !stress_run(type, level, budgets[i].budget[level - 1] * scale);
+		}
+	}
+	
+	if (failed) {
+		fprintf(stderr, "Error: %d test(s) failed\n", failed);
+		return -1;
+	}
+	printf("All tests passed.\n");
+	return 0;
+}